@@ -1,301 +1,5624 @@
 ﻿#include <iostream>
-#include <utility>     // std::swap
+#include <utility>     // std::swap, std::move
+#include <type_traits> // std::is_nothrow_move_constructible
 #include <stdexcept>   // std::out_of_range, std::exception
-#include <cstddef>     // size_t
+#include <cstddef>     // size_t, std::max_align_t
+#include <cstdint>     // uintptr_t, uint64_t
+#include <atomic>      // std::atomic (ресурс памяти по умолчанию)
 #include <clocale>     // setlocale
+#include <cassert>     // assert
+#include <chrono>      // замеры времени в бенчмарках
+#include <iomanip>     // std::setw в таблице бенчмарков
+#include <vector>      // std::vector
+#include <thread>      // std::thread
+#include <exception>   // std::exception_ptr
+#include <functional>  // std::hash
+#include <new>         // placement new
+#include <mutex>       // std::mutex (вставка в StringPool)
+#include <condition_variable> // ожидание задач в parallel::ThreadPool
+#include <deque>       // очереди задач parallel::ThreadPool
+#include <cstdio>      // fopen/fread: чтение файла потоком в MappedFile
+#include <limits>      // std::numeric_limits (разбор чисел)
+
+// Доступные наборы SIMD-инструкций (определяются по целевой платформе).
+// IND3_NO_SIMD отключает векторные ядра целиком.
+#if !defined(IND3_NO_SIMD)
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define IND3_SSE2 1
+#include <immintrin.h> // SSE2 / AVX2
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define IND3_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>    // __cpuid, _BitScanForward
+#endif
+
+// До любого заголовка Windows: без макросов min/max, мешающих
+// std::numeric_limits<...>::max(), и без лишних частей windows.h
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#endif
+
+// Отображение файлов в память для MappedFile.
+// IND3_NO_MMAP оставляет только чтение потоком.
+#if !defined(IND3_NO_MMAP)
+#if defined(_WIN32)
+#define IND3_MMAP_WIN32 1
+#include <windows.h>   // CreateFileMappingA, MapViewOfFile
+#elif defined(__unix__) || defined(__APPLE__)
+#define IND3_MMAP_POSIX 1
+#include <sys/mman.h>  // mmap, madvise
+#include <sys/stat.h>  // fstat
+#include <fcntl.h>     // open
+#include <unistd.h>    // close
+#endif
+#endif
+
+// Буферы для writev / WSASend (StringChain::io_buffers)
+#if defined(_WIN32)
+#include <winsock2.h>  // WSABUF
+#elif defined(__unix__) || defined(__APPLE__)
+#define IND3_HAS_IOVEC 1
+#include <sys/uio.h>   // iovec
+#endif
+
+// Генератор кусков на корутинах (StringGenerator) — только при сборке как C++20
+#if defined(__cpp_impl_coroutine)
+#define IND3_COROUTINES 1
+#include <coroutine>
+#endif
+
+// Числа с плавающей точкой в String (append_double / parse_double): std::to_chars
+// и std::from_chars, если библиотека C++17 поддерживает их для double,
+// иначе snprintf / strtod с подменой десятичного разделителя локали
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L
+#include <charconv>
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define IND3_TO_CHARS 1
+#else
+#include <cstdlib>     // strtod
+#endif
+
+// Проверка индекса в operator[]: 1 — бросать std::out_of_range, 0 — только assert.
+// По умолчанию проверка включена в Debug и отключена в Release (NDEBUG).
+// at() проверяет индекс всегда.
+#if !defined(IND3_CHECKED_INDEX)
+#if defined(NDEBUG)
+#define IND3_CHECKED_INDEX 0
+#else
+#define IND3_CHECKED_INDEX 1
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define IND3_TARGET_AVX2 __attribute__((target("avx2")))
+// Выровненное чтение может задеть байты до начала или после конца строки
+// в пределах того же 16/32-байтного блока (страницу оно не пересекает).
+// Это корректно, но AddressSanitizer считает такое чтение ошибкой.
+#define IND3_NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define IND3_TARGET_AVX2
+#define IND3_NO_ASAN
+#endif
+
+// -------------------- Ресурсы памяти --------------------
+// Источник памяти для буферов String — упрощённый аналог
+// std::pmr::memory_resource (в C++14 его ещё нет). Каждый буфер String
+// освобождается тем же ресурсом, которым был выделен.
+class MemoryResource {
+public:
+    virtual ~MemoryResource() {}
+
+    // Выделить bytes байт (может бросить std::bad_alloc)
+    void* allocate(size_t bytes) { return do_allocate(bytes); }
+    // Вернуть память, ранее выделенную allocate(bytes)
+    void deallocate(void* p, size_t bytes) noexcept { do_deallocate(p, bytes); }
+
+    // Ресурс по умолчанию, который берут новые строки
+    static MemoryResource* default_resource() noexcept { return default_slot().load(); }
+    // Заменить ресурс по умолчанию; возвращает предыдущий.
+    // nullptr восстанавливает new/delete.
+    static MemoryResource* set_default_resource(MemoryResource* r) noexcept;
+
+protected:
+    virtual void* do_allocate(size_t bytes) = 0;
+    virtual void do_deallocate(void* p, size_t bytes) noexcept = 0;
+
+private:
+    static std::atomic<MemoryResource*>& default_slot() noexcept;
+};
+
+// Ресурс на основе new[]/delete[] — поведение String по умолчанию
+class NewDeleteResource : public MemoryResource {
+public:
+    static NewDeleteResource* instance() noexcept {
+        static NewDeleteResource res;
+        return &res;
+    }
+
+protected:
+    void* do_allocate(size_t bytes) override { return new char[bytes]; }
+    void do_deallocate(void* p, size_t) noexcept override { delete[] static_cast<char*>(p); }
+};
+
+inline std::atomic<MemoryResource*>& MemoryResource::default_slot() noexcept {
+    static std::atomic<MemoryResource*> slot(NewDeleteResource::instance());
+    return slot;
+}
+
+inline MemoryResource* MemoryResource::set_default_resource(MemoryResource* r) noexcept {
+    if (!r) r = NewDeleteResource::instance();
+    return default_slot().exchange(r);
+}
+
+// Выравнивание, которое гарантируют ArenaResource и PoolResource
+const size_t kResourceAlign = alignof(std::max_align_t);
+
+inline size_t align_up(size_t n, size_t a) { return (n + a - 1) & ~(a - 1); }
+
+// Монотонная арена (bump-аллокатор): память выдаётся подряд из крупных блоков,
+// deallocate ничего не делает, всё освобождается разом в release()/деструкторе.
+// Подходит для множества короткоживущих строк одного запроса.
+// Не потокобезопасна.
+class ArenaResource : public MemoryResource {
+public:
+    explicit ArenaResource(size_t block_size = 64 * 1024,
+                           MemoryResource* upstream = NewDeleteResource::instance())
+        : upstream_(upstream), blocks_(nullptr), cur_(nullptr), left_(0),
+          block_size_(block_size) {}
+
+    ArenaResource(const ArenaResource&) = delete;
+    ArenaResource& operator=(const ArenaResource&) = delete;
+
+    ~ArenaResource() { release(); }
+
+    // Освободить все блоки. Строки, выделенные в арене, после этого недействительны.
+    void release() noexcept {
+        while (blocks_) {
+            Block* next = blocks_->next;
+            upstream_->deallocate(blocks_, blocks_->size);
+            blocks_ = next;
+        }
+        cur_ = nullptr;
+        left_ = 0;
+    }
+
+protected:
+    void* do_allocate(size_t bytes) override {
+        bytes = align_up(bytes, kResourceAlign);
+        if (bytes > left_) {
+            size_t header = align_up(sizeof(Block), kResourceAlign);
+            size_t size = header + (bytes > block_size_ ? bytes : block_size_);
+            Block* b = static_cast<Block*>(upstream_->allocate(size)); // может бросить
+            b->next = blocks_;
+            b->size = size;
+            blocks_ = b;
+            cur_ = reinterpret_cast<char*>(b) + header;
+            left_ = size - header;
+        }
+        void* p = cur_;
+        cur_ += bytes;
+        left_ -= bytes;
+        return p;
+    }
+
+    void do_deallocate(void*, size_t) noexcept override {} // освобождение — только в release()
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    MemoryResource* upstream_;
+    Block* blocks_;     // список выделенных блоков
+    char* cur_;         // начало свободного места в текущем блоке
+    size_t left_;       // сколько байт осталось в текущем блоке
+    size_t block_size_; // размер очередного блока
+};
+
+// Пул с классами размеров 16, 32, ..., 4096 байт: освобождённые куски
+// кладутся в список свободных своего класса и переиспользуются без обращения
+// к upstream. Более крупные запросы уходят напрямую в upstream.
+// Вся память возвращается в деструкторе. Не потокобезопасен.
+class PoolResource : public MemoryResource {
+public:
+    explicit PoolResource(MemoryResource* upstream = NewDeleteResource::instance())
+        : upstream_(upstream), chunks_(nullptr)
+    {
+        for (size_t i = 0; i < kClassCount; ++i) free_[i] = nullptr;
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource() {
+        while (chunks_) {
+            Chunk* next = chunks_->next;
+            upstream_->deallocate(chunks_, chunks_->size);
+            chunks_ = next;
+        }
+    }
+
+protected:
+    void* do_allocate(size_t bytes) override {
+        size_t cls = class_of(bytes);
+        if (cls == kClassCount) return upstream_->allocate(bytes);
+        if (!free_[cls]) refill(cls); // может бросить
+        Node* n = free_[cls];
+        free_[cls] = n->next;
+        return n;
+    }
+
+    void do_deallocate(void* p, size_t bytes) noexcept override {
+        size_t cls = class_of(bytes);
+        if (cls == kClassCount) {
+            upstream_->deallocate(p, bytes);
+            return;
+        }
+        Node* n = static_cast<Node*>(p);
+        n->next = free_[cls];
+        free_[cls] = n;
+    }
+
+private:
+    static const size_t kMinClass = 16;      // наименьший класс размеров
+    static const size_t kClassCount = 9;     // 16 .. 4096
+    static const size_t kChunkSize = 64 * 1024;
+
+    struct Node { Node* next; };
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+
+    // Номер класса размеров для bytes (kClassCount — слишком большой запрос)
+    static size_t class_of(size_t bytes) {
+        size_t cls = 0;
+        size_t sz = kMinClass;
+        while (sz < bytes && cls < kClassCount) { sz *= 2; ++cls; }
+        return cls;
+    }
+
+    // Нарезать новый кусок от upstream на блоки класса cls
+    void refill(size_t cls) {
+        size_t block = kMinClass << cls;
+        size_t header = align_up(sizeof(Chunk), kResourceAlign);
+        Chunk* c = static_cast<Chunk*>(upstream_->allocate(kChunkSize)); // может бросить
+        c->next = chunks_;
+        c->size = kChunkSize;
+        chunks_ = c;
+        char* p = reinterpret_cast<char*>(c) + header;
+        char* end = reinterpret_cast<char*>(c) + kChunkSize;
+        for (; p + block <= end; p += block) {
+            Node* n = reinterpret_cast<Node*>(p);
+            n->next = free_[cls];
+            free_[cls] = n;
+        }
+    }
+
+    MemoryResource* upstream_;
+    Chunk* chunks_;            // куски, полученные от upstream
+    Node* free_[kClassCount];  // списки свободных блоков по классам
+};
+
+namespace detail {
+
+// Тот, у кого есть данные на каждый номер потока (кэши RecyclingResource):
+// при завершении потока он сбрасывает его данные, пока номер ещё не отдан
+// другому потоку
+struct ThreadExitListener {
+    virtual void thread_exited(size_t index) noexcept = 0;
+
+protected:
+    ~ThreadExitListener() {}
+};
+
+// Номера потоков 0, 1, 2, ... и подписчики на завершение потоков. Берётся
+// наименьший из освободившихся номеров. Намеренно не уничтожается: потоки
+// могут завершаться и после выхода из main.
+struct ThreadRegistry {
+    std::mutex mutex;
+    std::vector<size_t> free;
+    std::vector<ThreadExitListener*> listeners;
+    size_t next;
+
+    static ThreadRegistry& instance() {
+        static ThreadRegistry* r = new ThreadRegistry{ {}, {}, {}, 0 };
+        return *r;
+    }
+};
+
+const size_t kNoThreadIndex = static_cast<size_t>(-1);
+
+// Номер потока и признак завершения — тривиальные thread_local: их можно
+// читать и после разрушения ThreadIndex, из деструкторов других thread_local
+inline size_t& thread_index_slot() {
+    thread_local size_t index = kNoThreadIndex;
+    return index;
+}
+inline bool& thread_exiting() {
+    thread_local bool exiting = false;
+    return exiting;
+}
+
+// Владение номером потока. В деструкторе поток помечается завершающимся
+// (дальше thread_index() возвращает kNoThreadIndex), подписчики сбрасывают
+// его данные, и только после этого номер возвращается в реестр.
+struct ThreadIndex {
+    ThreadIndex() {
+        ThreadRegistry& r = ThreadRegistry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (r.free.empty()) {
+            thread_index_slot() = r.next++;
+        }
+        else {
+            thread_index_slot() = r.free.back();
+            r.free.pop_back();
+        }
+    }
+    ~ThreadIndex() {
+        thread_exiting() = true;
+        size_t index = thread_index_slot();
+        thread_index_slot() = kNoThreadIndex;
+        ThreadRegistry& r = ThreadRegistry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (ThreadExitListener* l : r.listeners) l->thread_exited(index);
+        r.free.push_back(index);
+    }
+};
+
+// Номер вызывающего потока, либо kNoThreadIndex, если поток уже завершается
+inline size_t thread_index() {
+    if (thread_exiting()) return kNoThreadIndex;
+    thread_local ThreadIndex owner;
+    return thread_index_slot();
+}
+
+} // namespace detail
+
+// Переиспользование буферов строк между потоками. Освобождённый буфер
+// попадает в кэш своего потока — список класса ёмкости 32, 64, ..., max_block
+// байт. Переполненный кэш сбрасывается пачками в общий lock-free стек класса
+// (push — CAS, забрать — exchange всего стека, поэтому ABA невозможна), откуда
+// пачки берут другие потоки. Новый upstream->allocate нужен только когда пусты
+// и кэш потока, и общий стек. Запросы крупнее max_block идут мимо пула.
+// Память ограничена: не больше thread_cache_bytes в кэше потока и global_bytes
+// в общих стеках, лишнее сразу возвращается upstream; trim() отдаёт накопленное.
+// При завершении потока его кэш сбрасывается в общие стеки; строки, которые
+// поток освобождает уже после этого (thread_local), идут прямо в общий стек.
+// Потокобезопасен; уничтожать, когда ресурсом уже никто не пользуется.
+class RecyclingResource : public MemoryResource, private detail::ThreadExitListener {
+public:
+    struct Limits {
+        size_t max_block;          // наибольший переиспользуемый блок, байт
+        size_t thread_cache_bytes; // в кэше одного потока
+        size_t global_bytes;       // во всех общих стеках вместе
+
+        static Limits defaults() { Limits l = { 1 << 20, 1 << 20, 64 << 20 }; return l; }
+    };
+
+    explicit RecyclingResource(Limits limits = Limits::defaults(),
+                               MemoryResource* upstream = NewDeleteResource::instance())
+        : upstream_(upstream), limits_(limits), class_count_(0), global_bytes_(0), upstream_allocations_(0)
+    {
+        while (class_count_ < kMaxClasses && (kMinBlock << class_count_) <= limits.max_block) ++class_count_;
+        for (size_t i = 0; i < kMaxClasses; ++i) global_[i].store(nullptr, std::memory_order_relaxed);
+        for (size_t i = 0; i < kMaxThreads; ++i) caches_[i].store(nullptr, std::memory_order_relaxed);
+        detail::ThreadRegistry& r = detail::ThreadRegistry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.listeners.push_back(this);
+    }
+
+    RecyclingResource(const RecyclingResource&) = delete;
+    RecyclingResource& operator=(const RecyclingResource&) = delete;
+
+    ~RecyclingResource() {
+        {
+            // После отписки завершающиеся потоки уже не трогают caches_
+            detail::ThreadRegistry& r = detail::ThreadRegistry::instance();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (size_t i = 0; i < r.listeners.size(); ++i) {
+                if (r.listeners[i] != this) continue;
+                r.listeners.erase(r.listeners.begin() + static_cast<std::ptrdiff_t>(i));
+                break;
+            }
+        }
+        trim_global();
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            ThreadCache* c = caches_[i].load(std::memory_order_acquire);
+            if (!c) continue;
+            trim_cache(c);
+            delete c;
+        }
+    }
+
+    // Общий пул процесса. Намеренно не уничтожается: строки в статических
+    // объектах и завершающихся потоках могут освобождаться и после main.
+    static RecyclingResource* instance() {
+        static RecyclingResource* res = new RecyclingResource();
+        return res;
+    }
+
+    // Вернуть upstream содержимое общих стеков и кэша вызывающего потока.
+    // Кэши других работающих потоков (каждый не больше thread_cache_bytes)
+    // освобождает их собственный trim(); кэши завершившихся уже в общих стеках.
+    void trim() noexcept {
+        if (ThreadCache* c = cache()) trim_cache(c);
+        trim_global();
+    }
+
+    // Сколько байт лежит в общих стеках
+    size_t global_bytes() const noexcept { return global_bytes_.load(std::memory_order_relaxed); }
+    // Сколько раз пришлось выделять память у upstream (промахи пула)
+    size_t upstream_allocations() const noexcept { return upstream_allocations_.load(std::memory_order_relaxed); }
+
+protected:
+    void* do_allocate(size_t bytes) override {
+        size_t cls = class_of(bytes);
+        if (cls == class_count_) return upstream_->allocate(bytes);
+        ThreadCache* c = cache();
+        if (c && c->lists[cls]) {
+            Node* n = c->lists[cls];
+            c->lists[cls] = n->next;
+            --c->counts[cls];
+            c->bytes -= block_size(cls);
+            return n;
+        }
+        if (Node* batch = take_batch(cls)) {
+            if (c) { // остаток пачки — в кэш потока
+                c->lists[cls] = batch->next;
+                c->counts[cls] = batch->count - 1;
+                c->bytes += (batch->count - 1) * block_size(cls);
+            }
+            else if (batch->next) {
+                push_batch(cls, batch->next, batch->count - 1);
+            }
+            return batch;
+        }
+        upstream_allocations_.fetch_add(1, std::memory_order_relaxed);
+        return upstream_->allocate(block_size(cls)); // может бросить
+    }
+
+    void do_deallocate(void* p, size_t bytes) noexcept override {
+        size_t cls = class_of(bytes);
+        if (cls == class_count_) {
+            upstream_->deallocate(p, bytes);
+            return;
+        }
+        Node* n = static_cast<Node*>(p);
+        ThreadCache* c = cache();
+        if (!c) { // поток без кэша: сразу в общий стек
+            n->next = nullptr;
+            push_batch(cls, n, 1);
+            return;
+        }
+        n->next = c->lists[cls];
+        c->lists[cls] = n;
+        ++c->counts[cls];
+        c->bytes += block_size(cls);
+        if (c->bytes > limits_.thread_cache_bytes) spill(c);
+    }
+
+private:
+    static const size_t kMinBlock = 32;    // наименьший класс (вмещает Node)
+    static const size_t kMaxClasses = 26;  // 32 Б .. 1 ГБ
+    static const size_t kMaxThreads = 256; // потоки с большим номером работают без кэша
+
+    // Свободный блок. В общем стеке первый блок пачки хранит её размер
+    // и ссылку на следующую пачку.
+    struct Node {
+        Node* next;
+        Node* next_batch;
+        size_t count;
+    };
+
+    struct ThreadCache {
+        Node* lists[kMaxClasses];
+        size_t counts[kMaxClasses];
+        size_t bytes;
+    };
+
+    static size_t block_size(size_t cls) { return kMinBlock << cls; }
+
+    // Номер класса для bytes (class_count_ — мимо пула)
+    size_t class_of(size_t bytes) const {
+        size_t cls = 0;
+        while (cls < class_count_ && block_size(cls) < bytes) ++cls;
+        return cls;
+    }
+
+    // Кэш вызывающего потока; nullptr — поток без кэша (номер больше
+    // kMaxThreads или поток уже завершается)
+    ThreadCache* cache() noexcept {
+        size_t i = detail::thread_index();
+        if (i >= kMaxThreads) return nullptr;
+        ThreadCache* c = caches_[i].load(std::memory_order_relaxed); // слот i принадлежит этому потоку
+        if (!c) {
+            c = new (std::nothrow) ThreadCache();
+            caches_[i].store(c, std::memory_order_release);
+        }
+        return c;
+    }
+
+    // Положить пачку из count блоков в общий стек класса или, если он
+    // переполнен, вернуть её upstream
+    void push_batch(size_t cls, Node* head, size_t count) noexcept {
+        size_t bytes = count * block_size(cls);
+        if (global_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes > limits_.global_bytes) {
+            global_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            release_list(cls, head);
+            return;
+        }
+        head->count = count;
+        Node* top = global_[cls].load(std::memory_order_relaxed);
+        do {
+            head->next_batch = top;
+        } while (!global_[cls].compare_exchange_weak(top, head, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Забрать одну пачку: весь стек снимается через exchange, первая пачка
+    // остаётся себе, остальные возвращаются одной цепочкой
+    Node* take_batch(size_t cls) noexcept {
+        if (!global_[cls].load(std::memory_order_relaxed)) return nullptr;
+        Node* batch = global_[cls].exchange(nullptr, std::memory_order_acquire);
+        if (!batch) return nullptr;
+        global_bytes_.fetch_sub(batch->count * block_size(cls), std::memory_order_relaxed);
+        Node* rest = batch->next_batch;
+        if (rest) {
+            Node* last = rest;
+            while (last->next_batch) last = last->next_batch;
+            Node* top = global_[cls].load(std::memory_order_relaxed);
+            do {
+                last->next_batch = top;
+            } while (!global_[cls].compare_exchange_weak(top, rest, std::memory_order_release, std::memory_order_relaxed));
+        }
+        return batch;
+    }
+
+    // Кэш потока переполнен: крупные классы целиком уходят пачками
+    // в общие стеки, пока кэш не опустеет до половины лимита
+    void spill(ThreadCache* c) noexcept {
+        for (size_t cls = class_count_; cls-- > 0 && c->bytes > limits_.thread_cache_bytes / 2;) {
+            if (!c->lists[cls]) continue;
+            c->bytes -= c->counts[cls] * block_size(cls);
+            push_batch(cls, c->lists[cls], c->counts[cls]);
+            c->lists[cls] = nullptr;
+            c->counts[cls] = 0;
+        }
+    }
+
+    // Поток index завершается: его кэш целиком уходит в общие стеки.
+    // Вызывается из этого же потока под mutex реестра.
+    void thread_exited(size_t index) noexcept override {
+        if (index >= kMaxThreads) return;
+        ThreadCache* c = caches_[index].load(std::memory_order_relaxed);
+        if (!c) return;
+        for (size_t cls = 0; cls < class_count_; ++cls) {
+            if (!c->lists[cls]) continue;
+            push_batch(cls, c->lists[cls], c->counts[cls]);
+            c->lists[cls] = nullptr;
+            c->counts[cls] = 0;
+        }
+        c->bytes = 0;
+    }
+
+    void release_list(size_t cls, Node* n) noexcept {
+        while (n) {
+            Node* next = n->next;
+            upstream_->deallocate(n, block_size(cls));
+            n = next;
+        }
+    }
+
+    void trim_cache(ThreadCache* c) noexcept {
+        for (size_t cls = 0; cls < class_count_; ++cls) {
+            release_list(cls, c->lists[cls]);
+            c->lists[cls] = nullptr;
+            c->counts[cls] = 0;
+        }
+        c->bytes = 0;
+    }
+
+    void trim_global() noexcept {
+        for (size_t cls = 0; cls < class_count_; ++cls) {
+            Node* batch = global_[cls].exchange(nullptr, std::memory_order_acquire);
+            while (batch) {
+                Node* next = batch->next_batch;
+                global_bytes_.fetch_sub(batch->count * block_size(cls), std::memory_order_relaxed);
+                release_list(cls, batch);
+                batch = next;
+            }
+        }
+    }
+
+    MemoryResource* upstream_;
+    Limits limits_;
+    size_t class_count_;                         // классов в пуле (по max_block)
+    std::atomic<Node*> global_[kMaxClasses];      // общие стеки пачек по классам
+    std::atomic<size_t> global_bytes_;
+    std::atomic<size_t> upstream_allocations_;
+    std::atomic<ThreadCache*> caches_[kMaxThreads]; // кэш потока с номером i
+};
+
+// -------------------- Счётчики (IND3_STATS) --------------------
+// Включаются макросом IND3_STATS; без него IND3_STAT(...) не порождает кода,
+// а snapshot() возвращает нули. У каждого потока свой блок счётчиков на
+// отдельных кэш-линиях: поток пишет только в свой блок (relaxed load + store,
+// без атомарных RMW и без ложного разделения), snapshot() суммирует все
+// блоки. Блок завершившегося потока достаётся следующему новому потоку
+// вместе с накопленными значениями, поэтому суммы не теряются.
+namespace stats {
+
+enum Counter {
+    kAllocations,    // выделения буферов в куче
+    kFrees,          // освобождения буферов
+    kBytesAllocated, // байт запрошено у ресурсов памяти
+    kBytesCopied,    // байт скопировано в буферы строк
+    kReallocations,  // перенос содержимого из кучи в новый буфер (reserve, рост)
+    kWastedCapacity, // неиспользованная ёмкость освобождаемых буферов, байт
+    kCopyConstruct,
+    kMoveConstruct,
+    kCopyAssign,
+    kMoveAssign,
+    kConcat,         // материализация цепочки operator+
+    kAppend,         // operator+=
+    kPushBack,
+    kCompare,        // compare, <, >
+    kEqual,          // == и != двух String
+    kCounterCount
+};
+
+inline const char* counter_name(Counter c) {
+    static const char* const names[kCounterCount] = {
+        "allocations", "frees", "bytes_allocated", "bytes_copied", "reallocations",
+        "wasted_capacity", "copy_construct", "move_construct", "copy_assign", "move_assign",
+        "concat", "append", "push_back", "compare", "equal"
+    };
+    return names[c];
+}
+
+// Суммы по всем потокам на момент снимка
+struct Snapshot {
+    uint64_t values[kCounterCount];
+
+    uint64_t operator[](Counter c) const { return values[c]; }
+
+    // Что произошло между двумя снимками
+    Snapshot operator-(const Snapshot& earlier) const {
+        Snapshot d;
+        for (size_t i = 0; i < kCounterCount; ++i) d.values[i] = values[i] - earlier.values[i];
+        return d;
+    }
+};
+
+// Снимок в виде строк "name value" — удобно отдавать сборщику метрик
+inline void print(std::ostream& os, const Snapshot& s) {
+    for (size_t i = 0; i < kCounterCount; ++i)
+        os << counter_name(static_cast<Counter>(i)) << ' ' << s.values[i] << '\n';
+}
+
+#if defined(IND3_STATS)
+const bool kEnabled = true;
+
+namespace detail {
+
+const size_t kCacheLine = 64;
+
+struct Block {
+    std::atomic<uint64_t> values[kCounterCount];
+    Block* next_all;  // список всех блоков (только растёт)
+    Block* next_free; // список блоков завершившихся потоков
+};
+
+struct Registry {
+    Registry() : all(nullptr), free(nullptr) {}
+
+    std::mutex mutex;         // защищает free и добавление в all
+    std::atomic<Block*> all;
+    Block* free;
+};
+
+inline Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+inline Block* acquire_block() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (Block* b = r.free) {
+        r.free = b->next_free;
+        return b;
+    }
+    // Выравниваем вручную: в C++14 new не обязан соблюдать alignas(64).
+    // Блоки не освобождаются — их не больше, чем одновременно живших потоков.
+    char* raw = static_cast<char*>(::operator new(align_up(sizeof(Block), kCacheLine) + kCacheLine));
+    char* line = raw + (kCacheLine - reinterpret_cast<uintptr_t>(raw) % kCacheLine) % kCacheLine;
+    Block* b = new (line) Block;
+    for (size_t i = 0; i < kCounterCount; ++i) b->values[i].store(0, std::memory_order_relaxed);
+    b->next_free = nullptr;
+    b->next_all = r.all.load(std::memory_order_relaxed);
+    r.all.store(b, std::memory_order_release);
+    return b;
+}
+
+inline void release_block(Block* b) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    b->next_free = r.free;
+    r.free = b;
+}
+
+struct ThreadSlot {
+    ThreadSlot() : block(acquire_block()) {}
+    ~ThreadSlot() { release_block(block); }
+    Block* block;
+};
+
+inline Block& local_block() {
+    static thread_local ThreadSlot slot;
+    return *slot.block;
+}
+
+} // namespace detail
+
+inline void add(Counter c, uint64_t n) {
+    std::atomic<uint64_t>& v = detail::local_block().values[c];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); // пишет только этот поток
+}
+
+inline Snapshot snapshot() {
+    Snapshot s = {};
+    for (detail::Block* b = detail::registry().all.load(std::memory_order_acquire); b; b = b->next_all)
+        for (size_t i = 0; i < kCounterCount; ++i) s.values[i] += b->values[i].load(std::memory_order_relaxed);
+    return s;
+}
+
+#define IND3_STAT(counter, n) ::stats::add(::stats::counter, static_cast<uint64_t>(n))
+#else
+const bool kEnabled = false;
+
+inline Snapshot snapshot() {
+    Snapshot s = {};
+    return s;
+}
+
+#define IND3_STAT(counter, n) ((void)0)
+#endif
+
+} // namespace stats
+
+// -------------------- SIMD-ядра --------------------
+// Длина C-строки, поиск первого различающегося байта и копирование блока
+// байт — на них держатся конструкторы, конкатенация, reserve и сравнения String.
+// Вариант (AVX2 / SSE2 / NEON / скалярный) выбирается один раз при первом
+// вызове по возможностям процессора.
+namespace simd {
+
+inline unsigned ctz32(unsigned x) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return static_cast<unsigned>(i);
+#else
+    return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+}
+
+// ---- скалярные версии (запасной вариант) ----
+
+inline size_t length_scalar(const char* s) {
+    const char* p = s;
+    while (*p) ++p;
+    return static_cast<size_t>(p - s);
+}
+
+// Индекс первого i < n, где a[i] != b[i], или n, если различий нет
+inline size_t mismatch_scalar(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Копировать n байт из src в dst (области не перекрываются, как у memcpy)
+inline void copy_scalar(char* dst, const char* src, size_t n) {
+    for (size_t i = 0; i < n; ++i) dst[i] = src[i];
+}
+
+// Индекс первого байта, равного c, среди первых n, либо n (аналог memchr)
+inline size_t find_byte_scalar(const char* h, size_t n, char c) {
+    size_t i = 0;
+    while (i < n && h[i] != c) ++i;
+    return i;
+}
+
+// Первое вхождение needle (m >= 2) в h[0, n), либо n. Кандидаты отбираются по
+// совпадению первого и последнего байта, середина сверяется отдельно.
+inline size_t find_short_scalar(const char* h, size_t n, const char* needle, size_t m) {
+    if (m > n) return n;
+    for (size_t i = 0; i + m <= n; ++i) {
+        if (h[i] == needle[0] && h[i + m - 1] == needle[m - 1] &&
+            mismatch_scalar(h + i + 1, needle + 1, m - 2) == m - 2) return i;
+    }
+    return n;
+}
+
+// ASCII-буква в нижнем регистре, остальные байты без изменений
+inline unsigned char fold_ascii(unsigned char c) {
+    return static_cast<unsigned char>(c - 'A') < 26 ? static_cast<unsigned char>(c | 0x20) : c;
+}
+
+// Как mismatch_scalar, но ASCII-буквы сравниваются без учёта регистра
+inline size_t mismatch_icase_scalar(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    while (i < n && fold_ascii(static_cast<unsigned char>(a[i])) == fold_ascii(static_cast<unsigned char>(b[i]))) ++i;
+    return i;
+}
+
+// Записать в dst n байт из src, инвертируя регистр букв [first, first + 25]:
+// first == 'A' — перевод в нижний регистр, first == 'a' — в верхний.
+// dst == src допустимо (преобразование на месте).
+inline void flip_case_scalar(char* dst, const char* src, size_t n, char first) {
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = static_cast<unsigned char>(src[i]);
+        unsigned flip = static_cast<unsigned char>(c - first) < 26 ? 0x20u : 0u;
+        dst[i] = static_cast<char>(c ^ flip);
+    }
+}
+
+// До четырёх диапазонов байт [lo[k], lo[k] + span[k]] — так описываются классы
+// символов (см. CharClass). Попадание проверяется без ветвлений одним
+// беззнаковым сравнением (c - lo) <= span на каждый диапазон.
+struct ByteRanges {
+    unsigned char lo[4];
+    unsigned char span[4];
+    unsigned count;
+};
+
+// Число байт s[0, n), попавших хотя бы в один диапазон
+inline size_t count_ranges_scalar(const char* s, size_t n, const ByteRanges& r) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        bool hit = false;
+        for (unsigned k = 0; k < r.count; ++k) hit |= static_cast<unsigned char>(c - r.lo[k]) <= r.span[k];
+        total += hit;
+    }
+    return total;
+}
+
+// Длина корректной последовательности UTF-8 в начале s[0, n) (n > 0), либо 0.
+// Корректность — по таблице 3-7 стандарта Unicode: без overlong-форм,
+// суррогатов U+D800..U+DFFF и значений больше U+10FFFF.
+inline size_t utf8_char_length(const unsigned char* s, size_t n) {
+    unsigned char c = s[0];
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0; // продолжение или overlong C0 / C1
+    if (c < 0xE0) return (n >= 2 && (s[1] & 0xC0) == 0x80) ? 2 : 0;
+    if (c < 0xF0) {
+        if (n < 3 || (s[2] & 0xC0) != 0x80) return 0;
+        unsigned char lo = (c == 0xE0) ? 0xA0 : 0x80;
+        unsigned char hi = (c == 0xED) ? 0x9F : 0xBF;
+        return (s[1] >= lo && s[1] <= hi) ? 3 : 0;
+    }
+    if (c < 0xF5) {
+        if (n < 4 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80) return 0;
+        unsigned char lo = (c == 0xF0) ? 0x90 : 0x80;
+        unsigned char hi = (c == 0xF4) ? 0x8F : 0xBF;
+        return (s[1] >= lo && s[1] <= hi) ? 4 : 0;
+    }
+    return 0;
+}
+
+// Является ли s[0, n) корректным UTF-8
+inline bool utf8_valid_scalar(const char* s, size_t n) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i < n) {
+        if (p[i] < 0x80) { ++i; continue; }
+        size_t len = utf8_char_length(p + i, n - i);
+        if (!len) return false;
+        i += len;
+    }
+    return true;
+}
+
+#if defined(IND3_SSE2)
+// ---- SSE2: 16 байт за шаг ----
+
+IND3_NO_ASAN inline size_t length_sse2(const char* s) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t mis = reinterpret_cast<uintptr_t>(s) & 15;
+    const char* p = s - mis; // выровненный блок, содержащий начало строки
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(p)), zero))) >> mis;
+    if (mask) return ctz32(mask);
+    for (;;) {
+        p += 16;
+        mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(p)), zero)));
+        if (mask) return static_cast<size_t>(p - s) + ctz32(mask);
+    }
+}
+
+inline size_t mismatch_sse2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFFu) return i + ctz32(~eq & 0xFFFFu);
+    }
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+// Первые и последние 16 байт копируются невыровненно (с перекрытием),
+// середина — выровненными по dst записями
+inline void copy_sse2(char* dst, const char* src, size_t n) {
+    if (n < 16) { copy_scalar(dst, src, n); return; }
+    __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n - 16));
+    size_t i = 16 - (reinterpret_cast<uintptr_t>(dst) & 15);
+    for (; i + 16 <= n; i += 16) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), head);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + n - 16), tail);
+}
+
+inline size_t find_byte_sse2(const char* h, size_t n, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i)), needle)));
+        if (mask) return i + ctz32(mask);
+    }
+    return i + find_byte_scalar(h + i, n - i, c);
+}
+
+// "Generic SIMD" strstr (W. Muła): за шаг проверяются 16 позиций сразу —
+// сравниваются блоки, начинающиеся с первого и с последнего байта образца
+inline size_t find_short_sse2(const char* h, size_t n, const char* needle, size_t m) {
+    if (m > n) return n;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = ctz32(mask);
+            if (mismatch_sse2(h + i + bit + 1, needle + 1, m - 2) == m - 2) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    size_t r = find_short_scalar(h + i, n - i, needle, m);
+    return (r == n - i) ? n : i + r;
+}
+
+// Маска байт x из [lo, lo + span]: вычитание по модулю 256 и беззнаковое
+// сравнение через min (беззнакового cmpgt в SSE2 нет)
+inline __m128i range_mask_sse2(__m128i x, __m128i lo, __m128i span) {
+    __m128i t = _mm_sub_epi8(x, lo);
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, span), t);
+}
+
+inline __m128i fold_sse2(__m128i x) {
+    __m128i upper = range_mask_sse2(x, _mm_set1_epi8('A'), _mm_set1_epi8(25));
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+inline size_t mismatch_icase_sse2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = fold_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m128i vb = fold_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFFu) return i + ctz32(~eq & 0xFFFFu);
+    }
+    return i + mismatch_icase_scalar(a + i, b + i, n - i);
+}
+
+inline void flip_case_sse2(char* dst, const char* src, size_t n, char first) {
+    const __m128i lo = _mm_set1_epi8(first);
+    const __m128i span = _mm_set1_epi8(25);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+            _mm_xor_si128(x, _mm_and_si128(range_mask_sse2(x, lo, span), bit)));
+    }
+    flip_case_scalar(dst + i, src + i, n - i, first);
+}
+
+// Маски попаданий копятся в байтовых счётчиках (вычитание -1 даёт +1) и
+// сбрасываются в итог через psadbw не реже чем раз в 255 блоков
+inline size_t count_ranges_sse2(const char* s, size_t n, const ByteRanges& r) {
+    __m128i lo[4], span[4];
+    for (unsigned k = 0; k < r.count; ++k) {
+        lo[k] = _mm_set1_epi8(static_cast<char>(r.lo[k]));
+        span[k] = _mm_set1_epi8(static_cast<char>(r.span[k]));
+    }
+    const __m128i zero = _mm_setzero_si128();
+    size_t total = 0, i = 0;
+    while (i + 16 <= n) {
+        size_t blocks = (n - i) / 16;
+        if (blocks > 255) blocks = 255;
+        __m128i acc = zero;
+        for (; blocks; --blocks, i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            __m128i hit = zero;
+            for (unsigned k = 0; k < r.count; ++k) hit = _mm_or_si128(hit, range_mask_sse2(x, lo[k], span[k]));
+            acc = _mm_sub_epi8(acc, hit);
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        total += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+    return total + count_ranges_scalar(s + i, n - i, r);
+}
+
+// ASCII-блоки по 16 байт пропускаются целиком, остальное проверяется
+// скалярно (табличной проверке нужен pshufb, которого в SSE2 нет)
+inline bool utf8_valid_sse2(const char* s, size_t n) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i < n) {
+        if (i + 16 <= n && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))) == 0) {
+            i += 16;
+            continue;
+        }
+        size_t end = (n - i < 16) ? n : i + 16;
+        while (i < end) {
+            if (p[i] < 0x80) { ++i; continue; }
+            size_t len = utf8_char_length(p + i, n - i);
+            if (!len) return false;
+            i += len;
+        }
+    }
+    return true;
+}
+
+// ---- AVX2: 32 байта за шаг ----
+
+IND3_TARGET_AVX2 IND3_NO_ASAN inline size_t length_avx2(const char* s) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t mis = reinterpret_cast<uintptr_t>(s) & 31;
+    const char* p = s - mis;
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(p)), zero))) >> mis;
+    if (mask) return ctz32(mask);
+    for (;;) {
+        p += 32;
+        mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(p)), zero)));
+        if (mask) return static_cast<size_t>(p - s) + ctz32(mask);
+    }
+}
+
+IND3_TARGET_AVX2 inline size_t mismatch_avx2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFFFFFFu) return i + ctz32(~eq);
+    }
+    return i + mismatch_sse2(a + i, b + i, n - i);
+}
+
+// То же, что copy_sse2, но блоками по 32 байта и с развёрткой на 2 блока
+IND3_TARGET_AVX2 inline void copy_avx2(char* dst, const char* src, size_t n) {
+    if (n < 32) { copy_sse2(dst, src, n); return; }
+    __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + n - 32));
+    size_t i = 32 - (reinterpret_cast<uintptr_t>(dst) & 31);
+    for (; i + 64 <= n; i += 64) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i), v0);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i + 32), v1);
+    }
+    for (; i + 32 <= n; i += 32) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), head);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + n - 32), tail);
+}
+
+IND3_TARGET_AVX2 inline size_t find_byte_avx2(const char* h, size_t n, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i)), needle)));
+        if (mask) return i + ctz32(mask);
+    }
+    return i + find_byte_sse2(h + i, n - i, c);
+}
+
+IND3_TARGET_AVX2 inline size_t find_short_avx2(const char* h, size_t n, const char* needle, size_t m) {
+    if (m > n) return n;
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = ctz32(mask);
+            if (mismatch_avx2(h + i + bit + 1, needle + 1, m - 2) == m - 2) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    size_t r = find_short_sse2(h + i, n - i, needle, m);
+    return (r == n - i) ? n : i + r;
+}
+
+IND3_TARGET_AVX2 inline __m256i range_mask_avx2(__m256i x, __m256i lo, __m256i span) {
+    __m256i t = _mm256_sub_epi8(x, lo);
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, span), t);
+}
+
+IND3_TARGET_AVX2 inline __m256i fold_avx2(__m256i x) {
+    __m256i upper = range_mask_avx2(x, _mm256_set1_epi8('A'), _mm256_set1_epi8(25));
+    return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+IND3_TARGET_AVX2 inline size_t mismatch_icase_avx2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = fold_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        __m256i vb = fold_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFFFFFFu) return i + ctz32(~eq);
+    }
+    return i + mismatch_icase_sse2(a + i, b + i, n - i);
+}
+
+IND3_TARGET_AVX2 inline void flip_case_avx2(char* dst, const char* src, size_t n, char first) {
+    const __m256i lo = _mm256_set1_epi8(first);
+    const __m256i span = _mm256_set1_epi8(25);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+            _mm256_xor_si256(x, _mm256_and_si256(range_mask_avx2(x, lo, span), bit)));
+    }
+    flip_case_sse2(dst + i, src + i, n - i, first);
+}
+
+IND3_TARGET_AVX2 inline size_t count_ranges_avx2(const char* s, size_t n, const ByteRanges& r) {
+    __m256i lo[4], span[4];
+    for (unsigned k = 0; k < r.count; ++k) {
+        lo[k] = _mm256_set1_epi8(static_cast<char>(r.lo[k]));
+        span[k] = _mm256_set1_epi8(static_cast<char>(r.span[k]));
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    size_t total = 0, i = 0;
+    while (i + 32 <= n) {
+        size_t blocks = (n - i) / 32;
+        if (blocks > 255) blocks = 255;
+        __m256i acc = zero;
+        for (; blocks; --blocks, i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            __m256i hit = zero;
+            for (unsigned k = 0; k < r.count; ++k) hit = _mm256_or_si256(hit, range_mask_avx2(x, lo[k], span[k]));
+            acc = _mm256_sub_epi8(acc, hit);
+        }
+        __m256i sad = _mm256_sad_epu8(acc, zero);
+        __m128i sums = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+        total += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+    return total + count_ranges_sse2(s + i, n - i, r);
+}
+
+// Проверка UTF-8 по таблицам (Keiser, Lemire, "Validating UTF-8 In Less Than
+// One Instruction Per Byte"): ошибка определяется по старшей и младшей тетраде
+// предыдущего байта и старшей тетраде текущего — три pshufb на блок
+namespace utf8_lookup {
+enum : unsigned char {
+    kTooShort = 1 << 0,     // 11______ 0_______ / 11______ 11______
+    kTooLong = 1 << 1,      // 0_______ 10______
+    kOverlong3 = 1 << 2,    // 11100000 100_____
+    kTooLarge = 1 << 3,     // 11110100 1001____ и больше
+    kSurrogate = 1 << 4,    // 11101101 101_____
+    kOverlong2 = 1 << 5,    // 1100000_ 10______
+    kTooLarge1000 = 1 << 6, // 11110101 1000____ и больше
+    kOverlong4 = 1 << 6,    // 11110000 1000____
+    kTwoConts = 1 << 7,     // 10______ 10______
+    kCarry = kTooShort | kTooLong | kTwoConts
+};
+
+static const unsigned char kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4
+};
+static const unsigned char kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000
+};
+static const unsigned char kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort
+};
+// Байт в одной из трёх последних позиций блока, который ждёт продолжения:
+// >= 0xF0 за 3 байта до конца, >= 0xE0 за 2, >= 0xC0 в последней
+static const unsigned char kIncompleteMax[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xEF, 0xDF, 0xBF
+};
+} // namespace utf8_lookup
+
+IND3_TARGET_AVX2 inline __m256i lookup16_avx2(__m256i nibbles, const unsigned char* table) {
+    __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+    return _mm256_shuffle_epi8(t, nibbles);
+}
+
+// Блок input, сдвинутый на N байт назад с подстановкой хвоста prev
+template <int N>
+IND3_TARGET_AVX2 inline __m256i prev_bytes_avx2(__m256i input, __m256i prev) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
+
+// Ненулевые байты — ошибки UTF-8 в блоке input (с учётом конца prev)
+IND3_TARGET_AVX2 inline __m256i utf8_errors_avx2(__m256i input, __m256i prev) {
+    const __m256i low4 = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = prev_bytes_avx2<1>(input, prev);
+    __m256i byte_1_high = lookup16_avx2(_mm256_and_si256(_mm256_srli_epi16(prev1, 4), low4), utf8_lookup::kByte1High);
+    __m256i byte_1_low = lookup16_avx2(_mm256_and_si256(prev1, low4), utf8_lookup::kByte1Low);
+    __m256i byte_2_high = lookup16_avx2(_mm256_and_si256(_mm256_srli_epi16(input, 4), low4), utf8_lookup::kByte2High);
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    // Третий и четвёртый байты 3- и 4-байтовых последовательностей обязаны
+    // быть продолжениями: там ошибкой, наоборот, считается отсутствие kTwoConts
+    __m256i third = _mm256_subs_epu8(prev_bytes_avx2<2>(input, prev), _mm256_set1_epi8(0xE0 - 0x80));
+    __m256i fourth = _mm256_subs_epu8(prev_bytes_avx2<3>(input, prev), _mm256_set1_epi8(0xF0 - 0x80));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must_continue, special);
+}
+
+IND3_TARGET_AVX2 inline bool utf8_valid_avx2(const char* s, size_t n) {
+    const __m256i incomplete_max = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(utf8_lookup::kIncompleteMax));
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        if (_mm256_movemask_epi8(input) == 0) { // ASCII: ошибка, только если прошлый блок оборван
+            error = _mm256_or_si256(error, prev_incomplete);
+        }
+        else {
+            error = _mm256_or_si256(error, utf8_errors_avx2(input, prev));
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+        }
+        prev = input;
+    }
+    if (i < n) { // хвост дополняется нулями: оборванная последовательность даст kTooShort
+        unsigned char tail[32] = { 0 };
+        copy_scalar(reinterpret_cast<char*>(tail), s + i, n - i);
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+        error = _mm256_or_si256(error, utf8_errors_avx2(input, prev));
+    }
+    else {
+        error = _mm256_or_si256(error, prev_incomplete);
+    }
+    return _mm256_testz_si256(error, error) != 0;
+}
+
+// Поддерживает ли процессор (и ОС) AVX2
+inline bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    bool osxsave = (r[2] & (1 << 27)) != 0;
+    bool avx = (r[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 6) != 6) return false; // ОС сохраняет регистры YMM
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif // IND3_SSE2
+
+#if defined(IND3_NEON)
+// ---- NEON (AArch64): 16 байт за шаг ----
+
+inline unsigned ctz64(unsigned long long x) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return static_cast<unsigned>(i);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+// Маска сравнения: по 4 бита на каждый из 16 байт (аналог movemask)
+inline unsigned long long neon_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+IND3_NO_ASAN inline size_t length_neon(const char* s) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t mis = reinterpret_cast<uintptr_t>(s) & 15;
+    const char* p = s - mis;
+    unsigned long long mask = neon_mask(vceqq_u8(
+        vld1q_u8(reinterpret_cast<const uint8_t*>(p)), zero)) >> (4 * mis);
+    if (mask) return ctz64(mask) / 4;
+    for (;;) {
+        p += 16;
+        mask = neon_mask(vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), zero));
+        if (mask) return static_cast<size_t>(p - s) + ctz64(mask) / 4;
+    }
+}
+
+inline size_t mismatch_neon(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t va = vld1q_u8(reinterpret_cast<const uint8_t*>(a + i));
+        uint8x16_t vb = vld1q_u8(reinterpret_cast<const uint8_t*>(b + i));
+        unsigned long long ne = ~neon_mask(vceqq_u8(va, vb));
+        if (ne) return i + ctz64(ne) / 4;
+    }
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+inline void copy_neon(char* dst, const char* src, size_t n) {
+    if (n < 16) { copy_scalar(dst, src, n); return; }
+    uint8x16_t tail = vld1q_u8(reinterpret_cast<const uint8_t*>(src + n - 16));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), vld1q_u8(reinterpret_cast<const uint8_t*>(src + i)));
+    }
+    vst1q_u8(reinterpret_cast<uint8_t*>(dst + n - 16), tail);
+}
+
+inline size_t find_byte_neon(const char* h, size_t n, char c) {
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned long long mask = neon_mask(vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(h + i)), needle));
+        if (mask) return i + ctz64(mask) / 4;
+    }
+    return i + find_byte_scalar(h + i, n - i, c);
+}
+
+inline size_t find_short_neon(const char* h, size_t n, const char* needle, size_t m) {
+    if (m > n) return n;
+    const uint8x16_t first = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+    const uint8x16_t last = vdupq_n_u8(static_cast<uint8_t>(needle[m - 1]));
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        uint8x16_t block_first = vld1q_u8(reinterpret_cast<const uint8_t*>(h + i));
+        uint8x16_t block_last = vld1q_u8(reinterpret_cast<const uint8_t*>(h + i + m - 1));
+        unsigned long long mask = neon_mask(vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last)));
+        while (mask) {
+            unsigned bit = ctz64(mask) / 4;
+            if (mismatch_neon(h + i + bit + 1, needle + 1, m - 2) == m - 2) return i + bit;
+            mask &= ~(0xFULL << (bit * 4));
+        }
+    }
+    size_t r = find_short_scalar(h + i, n - i, needle, m);
+    return (r == n - i) ? n : i + r;
+}
+
+inline uint8x16_t range_mask_neon(uint8x16_t x, uint8x16_t lo, uint8x16_t span) {
+    return vcleq_u8(vsubq_u8(x, lo), span);
+}
+
+inline uint8x16_t fold_neon(uint8x16_t x) {
+    uint8x16_t upper = range_mask_neon(x, vdupq_n_u8('A'), vdupq_n_u8(25));
+    return vorrq_u8(x, vandq_u8(upper, vdupq_n_u8(0x20)));
+}
+
+inline size_t mismatch_icase_neon(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t va = fold_neon(vld1q_u8(reinterpret_cast<const uint8_t*>(a + i)));
+        uint8x16_t vb = fold_neon(vld1q_u8(reinterpret_cast<const uint8_t*>(b + i)));
+        unsigned long long ne = ~neon_mask(vceqq_u8(va, vb));
+        if (ne) return i + ctz64(ne) / 4;
+    }
+    return i + mismatch_icase_scalar(a + i, b + i, n - i);
+}
+
+inline void flip_case_neon(char* dst, const char* src, size_t n, char first) {
+    const uint8x16_t lo = vdupq_n_u8(static_cast<uint8_t>(first));
+    const uint8x16_t span = vdupq_n_u8(25);
+    const uint8x16_t bit = vdupq_n_u8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t*>(src + i));
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), veorq_u8(x, vandq_u8(range_mask_neon(x, lo, span), bit)));
+    }
+    flip_case_scalar(dst + i, src + i, n - i, first);
+}
+
+inline size_t count_ranges_neon(const char* s, size_t n, const ByteRanges& r) {
+    uint8x16_t lo[4], span[4];
+    for (unsigned k = 0; k < r.count; ++k) {
+        lo[k] = vdupq_n_u8(r.lo[k]);
+        span[k] = vdupq_n_u8(r.span[k]);
+    }
+    size_t total = 0, i = 0;
+    while (i + 16 <= n) {
+        size_t blocks = (n - i) / 16;
+        if (blocks > 255) blocks = 255;
+        uint8x16_t acc = vdupq_n_u8(0);
+        for (; blocks; --blocks, i += 16) {
+            uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t*>(s + i));
+            uint8x16_t hit = vdupq_n_u8(0);
+            for (unsigned k = 0; k < r.count; ++k) hit = vorrq_u8(hit, range_mask_neon(x, lo[k], span[k]));
+            acc = vsubq_u8(acc, hit);
+        }
+        total += vaddlvq_u8(acc);
+    }
+    return total + count_ranges_scalar(s + i, n - i, r);
+}
+
+// Как utf8_valid_sse2: ASCII-блоки пропускаются, остальное — скалярно
+inline bool utf8_valid_neon(const char* s, size_t n) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i < n) {
+        if (i + 16 <= n && vmaxvq_u8(vld1q_u8(p + i)) < 0x80) {
+            i += 16;
+            continue;
+        }
+        size_t end = (n - i < 16) ? n : i + 16;
+        while (i < end) {
+            if (p[i] < 0x80) { ++i; continue; }
+            size_t len = utf8_char_length(p + i, n - i);
+            if (!len) return false;
+            i += len;
+        }
+    }
+    return true;
+}
+#endif // IND3_NEON
+
+// ---- выбор ядра во время выполнения ----
+
+struct Kernels {
+    size_t (*length)(const char*);
+    size_t (*mismatch)(const char*, const char*, size_t);
+    void (*copy)(char*, const char*, size_t);
+    size_t (*find_byte)(const char*, size_t, char);
+    size_t (*find_short)(const char*, size_t, const char*, size_t);
+    size_t (*mismatch_icase)(const char*, const char*, size_t);
+    void (*flip_case)(char*, const char*, size_t, char);
+    size_t (*count_ranges)(const char*, size_t, const ByteRanges&);
+    bool (*utf8_valid)(const char*, size_t);
+    const char* name;
+};
+
+inline Kernels select_kernels() {
+#if defined(IND3_SSE2)
+    if (cpu_has_avx2()) {
+        Kernels k = { length_avx2, mismatch_avx2, copy_avx2, find_byte_avx2, find_short_avx2,
+                      mismatch_icase_avx2, flip_case_avx2, count_ranges_avx2, utf8_valid_avx2, "avx2" };
+        return k;
+    }
+    Kernels k = { length_sse2, mismatch_sse2, copy_sse2, find_byte_sse2, find_short_sse2,
+                      mismatch_icase_sse2, flip_case_sse2, count_ranges_sse2, utf8_valid_sse2, "sse2" };
+    return k;
+#elif defined(IND3_NEON)
+    Kernels k = { length_neon, mismatch_neon, copy_neon, find_byte_neon, find_short_neon,
+                      mismatch_icase_neon, flip_case_neon, count_ranges_neon, utf8_valid_neon, "neon" };
+    return k;
+#else
+    Kernels k = { length_scalar, mismatch_scalar, copy_scalar, find_byte_scalar, find_short_scalar,
+                      mismatch_icase_scalar, flip_case_scalar, count_ranges_scalar, utf8_valid_scalar, "scalar" };
+    return k;
+#endif
+}
+
+inline const Kernels& kernels() {
+    static const Kernels k = select_kernels(); // потокобезопасная инициализация
+    return k;
+}
+
+// Длина C-строки (аналог strlen без <cstring>)
+inline size_t str_length(const char* s) { return kernels().length(s); }
+
+// Индекс первого различающегося байта среди первых n, либо n
+inline size_t first_mismatch(const char* a, const char* b, size_t n) {
+    return kernels().mismatch(a, b, n);
+}
+
+// Копирование n байт (аналог memcpy без <cstring>); все копирования буферов
+// в String идут через эту функцию
+inline void copy_bytes(char* dst, const char* src, size_t n) {
+    kernels().copy(dst, src, n);
+}
+
+// Индекс первого байта c среди первых n, либо n
+inline size_t find_byte(const char* h, size_t n, char c) { return kernels().find_byte(h, n, c); }
+
+// Первое вхождение needle длины m >= 2 в h[0, n), либо n
+inline size_t find_short(const char* h, size_t n, const char* needle, size_t m) {
+    return kernels().find_short(h, n, needle, m);
+}
+
+// Как first_mismatch, но ASCII-буквы сравниваются без учёта регистра
+inline size_t first_mismatch_icase(const char* a, const char* b, size_t n) {
+    return kernels().mismatch_icase(a, b, n);
+}
+
+// Перевод ASCII-букв в нижний / верхний регистр при копировании n байт
+// из src в dst; прочие байты (в том числе UTF-8) не меняются, dst == src допустимо
+inline void to_lower(char* dst, const char* src, size_t n) { kernels().flip_case(dst, src, n, 'A'); }
+inline void to_upper(char* dst, const char* src, size_t n) { kernels().flip_case(dst, src, n, 'a'); }
+
+// Число байт s[0, n) из набора диапазонов r
+inline size_t count_ranges(const char* s, size_t n, const ByteRanges& r) {
+    return kernels().count_ranges(s, n, r);
+}
+
+// Является ли s[0, n) корректным UTF-8
+inline bool utf8_valid(const char* s, size_t n) { return kernels().utf8_valid(s, n); }
+
+// Название выбранного набора ядер (для диагностики)
+inline const char* kernel_name() { return kernels().name; }
+
+} // namespace simd
+
+// -------------------- Поиск подстроки --------------------
+// Searcher готовится один раз для образца и сам выбирает алгоритм по его длине:
+//  - 1 символ — векторный memchr (simd::find_byte);
+//  - до kShortNeedle символов — SIMD-фильтр по первому и последнему байту;
+//  - длиннее — Бойер–Мур–Хорспул (сдвиги по таблице плохих символов).
+// Образец не копируется и должен жить дольше Searcher.
+namespace search {
+
+const size_t npos = static_cast<size_t>(-1);
+const size_t kShortNeedle = 32;
+
+class Searcher {
+public:
+    Searcher(const char* needle, size_t m) : needle_(needle), m_(m) {
+        if (m_ > kShortNeedle) {
+            for (size_t c = 0; c < 256; ++c) shift_[c] = m_;
+            for (size_t i = 0; i + 1 < m_; ++i) shift_[static_cast<unsigned char>(needle_[i])] = m_ - 1 - i;
+        }
+    }
+
+    size_t length() const { return m_; }
+
+    // Первое вхождение в h[from, n), либо npos
+    size_t find(const char* h, size_t n, size_t from = 0) const {
+        if (from > n || m_ > n - from) return npos;
+        const char* start = h + from;
+        size_t len = n - from;
+        size_t r;
+        if (m_ == 0) return from;
+        else if (m_ == 1) r = simd::find_byte(start, len, needle_[0]);
+        else if (m_ <= kShortNeedle) r = simd::find_short(start, len, needle_, m_);
+        else r = horspool(start, len);
+        return (r == len) ? npos : from + r;
+    }
+
+private:
+    size_t horspool(const char* h, size_t n) const {
+        size_t i = 0;
+        const char last = needle_[m_ - 1];
+        while (i + m_ <= n) {
+            char c = h[i + m_ - 1];
+            if (c == last && simd::first_mismatch(h + i, needle_, m_ - 1) == m_ - 1) return i;
+            i += shift_[static_cast<unsigned char>(c)];
+        }
+        return n;
+    }
+
+    const char* needle_;
+    size_t m_;
+    size_t shift_[256]; // используется только для длинных образцов
+};
+
+} // namespace search
+
+// -------------------- Хеширование --------------------
+// Быстрый некриптографический 64-битный хеш в духе wyhash: блоки по 8 байт
+// смешиваются умножением 64x64 -> 128 бит, по 48 байт за шаг в три потока.
+namespace hashing {
+
+const uint64_t kSecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+// Полное произведение a * b: младшая половина в a, старшая в b
+inline void mul128(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+    a = lo;
+    b = hi;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    mul128(a, b);
+    return a ^ b;
+}
+
+// Чтение little-endian слов; компилятор сводит их к одной загрузке
+inline uint64_t read8(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+inline uint64_t read4(const unsigned char* p) {
+    return static_cast<uint64_t>(p[0]) | (static_cast<uint64_t>(p[1]) << 8) |
+           (static_cast<uint64_t>(p[2]) << 16) | (static_cast<uint64_t>(p[3]) << 24);
+}
+
+inline uint64_t hash_bytes(const char* data, size_t len, uint64_t seed = 0) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t shift = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + shift);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - shift);
+        }
+        else if (len > 0) {
+            a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ kSecret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ kSecret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ kSecret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ kSecret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    mul128(a, b);
+    return mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+} // namespace hashing
+
+// -------------------- Числа в текст и обратно --------------------
+// Десятичная запись целых (по две цифры за шаг по таблице) и кратчайшая
+// запись double, которая читается обратно в то же значение. Формат как у
+// std::to_chars / from_chars: без ведущих пробелов и '+', разделитель — '.'
+// независимо от локали.
+namespace number {
+
+static const char kDigitPairs[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// Запас под самую длинную кратчайшую запись double ("-2.2250738585072014e-308")
+const size_t kMaxDoubleChars = 32;
+
+inline unsigned count_digits(uint64_t v) {
+    unsigned n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+// Записать v ровно в digits = count_digits(v) символов dst, с конца
+inline void write_uint(char* dst, uint64_t v, unsigned digits) {
+    char* p = dst + digits;
+    while (v >= 100) {
+        unsigned i = static_cast<unsigned>(v % 100) * 2;
+        v /= 100;
+        *--p = kDigitPairs[i + 1];
+        *--p = kDigitPairs[i];
+    }
+    if (v >= 10) {
+        unsigned i = static_cast<unsigned>(v) * 2;
+        *--p = kDigitPairs[i + 1];
+        *--p = kDigitPairs[i];
+    }
+    else {
+        *--p = static_cast<char>('0' + v);
+    }
+}
+
+// Модуль v и знак без сравнений "v < 0" (их не бывает у беззнаковых типов)
+template <class Int>
+bool split_sign(Int v, uint64_t& magnitude) {
+    typedef typename std::make_unsigned<Int>::type U;
+    U u = static_cast<U>(v);
+    bool negative = std::is_signed<Int>::value && (u >> (sizeof(U) * 8 - 1)) != 0;
+    magnitude = negative ? static_cast<U>(U(0) - u) : u;
+    return negative;
+}
+
+// Разобрать десятичное целое в начале s[0, n). Возвращает число прочитанных
+// символов; 0 — цифр нет или значение не помещается в Int (out не меняется).
+template <class Int>
+size_t parse_int(const char* s, size_t n, Int& out) {
+    typedef typename std::make_unsigned<Int>::type U;
+    size_t i = 0;
+    bool negative = std::is_signed<Int>::value && n && s[0] == '-';
+    if (negative) i = 1;
+    const U limit = static_cast<U>(static_cast<U>(std::numeric_limits<Int>::max()) + (negative ? 1 : 0));
+    const size_t start = i;
+    // Первые digits10 цифр заведомо помещаются в U — без проверок переполнения
+    const size_t fast_end = (n - i < static_cast<size_t>(std::numeric_limits<U>::digits10))
+        ? n : i + std::numeric_limits<U>::digits10;
+    U v = 0;
+    for (; i < fast_end; ++i) {
+        unsigned d = static_cast<unsigned char>(s[i]) - static_cast<unsigned>('0');
+        if (d > 9) break;
+        v = static_cast<U>(v * 10 + d);
+    }
+    if (i == fast_end) {
+        for (; i < n; ++i) {
+            unsigned d = static_cast<unsigned char>(s[i]) - static_cast<unsigned>('0');
+            if (d > 9) break;
+            if (v > (std::numeric_limits<U>::max() - d) / 10) return 0;
+            v = static_cast<U>(v * 10 + d);
+        }
+    }
+    if (i == start || v > limit) return 0;
+    out = static_cast<Int>(negative ? static_cast<U>(U(0) - v) : v);
+    return i;
+}
+
+#if !defined(IND3_TO_CHARS)
+// Десятичный разделитель текущей локали (setlocale(LC_ALL, "ru") даёт ',')
+inline char locale_point() {
+    const char* point = std::localeconv()->decimal_point;
+    return (point && point[0]) ? point[0] : '.';
+}
+
+// Длина записи числа в начале s[0, n): [-] цифры [. цифры] [e [+-] цифры],
+// либо inf / infinity / nan без учёта регистра; 0 — числа нет
+inline size_t scan_double(const char* s, size_t n) {
+    size_t i = (n && s[0] == '-') ? 1 : 0;
+    size_t mantissa = 0;
+    while (i < n && static_cast<unsigned>(s[i] - '0') < 10) { ++i; ++mantissa; }
+    if (i < n && s[i] == '.') {
+        ++i;
+        while (i < n && static_cast<unsigned>(s[i] - '0') < 10) { ++i; ++mantissa; }
+    }
+    if (mantissa == 0) {
+        size_t sign = (n && s[0] == '-') ? 1 : 0;
+        const char* words[] = { "infinity", "inf", "nan" };
+        for (const char* w : words) {
+            size_t len = 0;
+            while (w[len]) ++len;
+            if (n - sign >= len && simd::first_mismatch_icase(s + sign, w, len) == len) return sign + len;
+        }
+        return 0;
+    }
+    if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+        size_t j = i + 1;
+        if (j < n && (s[j] == '+' || s[j] == '-')) ++j;
+        size_t exp_start = j;
+        while (j < n && static_cast<unsigned>(s[j] - '0') < 10) ++j;
+        if (j > exp_start) i = j; // "1e" без цифр порядка — это просто "1"
+    }
+    return i;
+}
+
+// Степени 10, точно представимые в double
+static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Быстрый путь без snprintf для 1e-3 <= a < 1e15: ищется наименьшее k, при
+// котором a == m / 10^k для целого m. Частное точных m и 10^k округляется
+// так же, как strtod читает запись "m / 10^k", поэтому она обратима.
+// Значащие цифры m (без нулей в конце) пишутся в digits, порядок старшей
+// цифры — в exp10. false — значение не подходит, нужен snprintf.
+inline bool shortest_digits_fast(double a, char* digits, unsigned& count, int& exp10) {
+    if (!(a >= 1e-3 && a < 1e15)) return false;
+    for (unsigned k = 0; k <= 15; ++k) {
+        double scaled = a * kPow10[k];
+        if (scaled >= 1e15) break;
+        uint64_t m = static_cast<uint64_t>(scaled + 0.5);
+        if (static_cast<double>(m) / kPow10[k] != a) continue;
+        exp10 = static_cast<int>(count_digits(m)) - 1 - static_cast<int>(k);
+        while (m % 10 == 0) m /= 10;
+        count = count_digits(m);
+        write_uint(digits, m, count);
+        return true;
+    }
+    return false;
+}
+
+// То же через snprintf("%.*e") и strtod для любого конечного v. Начинает
+// с 15 значащих цифр (хватает большинству значений) и убирает по одной,
+// пока запись читается обратно в v; если 15 мало — добавляет до 17.
+// Возвращает true для отрицательного v (в том числе -0).
+inline bool shortest_digits(double v, char* digits, unsigned& count, int& exp10) {
+    char buf[kMaxDoubleChars];
+    char best[kMaxDoubleChars];
+    int precision = 15;
+    std::snprintf(best, sizeof(best), "%.*e", precision - 1, v);
+    if (std::strtod(best, nullptr) == v) {
+        while (precision > 1) {
+            std::snprintf(buf, sizeof(buf), "%.*e", precision - 2, v);
+            if (std::strtod(buf, nullptr) != v) break;
+            --precision;
+            for (size_t i = 0; i < sizeof(buf); ++i) best[i] = buf[i];
+        }
+    }
+    else {
+        while (precision < 17) {
+            ++precision;
+            std::snprintf(best, sizeof(best), "%.*e", precision - 1, v);
+            if (std::strtod(best, nullptr) == v) break;
+        }
+    }
+    // best: [-] d [<разделитель> d...] e [+-] d...
+    size_t i = 0;
+    bool negative = best[0] == '-';
+    if (negative) i = 1;
+    count = 0;
+    for (; best[i] != 'e'; ++i)
+        if (static_cast<unsigned>(best[i] - '0') < 10) digits[count++] = best[i];
+    while (count > 1 && digits[count - 1] == '0') --count;
+    ++i;
+    bool exp_negative = best[i] == '-';
+    int e = 0;
+    for (++i; best[i]; ++i) e = e * 10 + (best[i] - '0');
+    exp10 = exp_negative ? -e : e;
+    return negative;
+}
+
+// Записать число с цифрами digits[0, count) и порядком старшей цифры exp10
+// как std::to_chars: из фиксированной и научной ("1.5e+10", "5e-324")
+// записей берётся более короткая, при равной длине — фиксированная.
+// Целые от 1e15 в фиксированной записи печатаются точно (v), а не нулями
+// после кратчайших цифр.
+inline size_t write_shortest(char* out, double v, bool negative, const char* digits, unsigned count, int exp10) {
+    int n = static_cast<int>(count);
+    int fixed = exp10 >= 0
+        ? (n > exp10 + 1 ? n + 1 : exp10 + 1)
+        : 2 + (-exp10 - 1) + n;
+    int exp_abs = exp10 < 0 ? -exp10 : exp10;
+    int scientific = n + (n > 1 ? 1 : 0) + 2 + (exp_abs >= 100 ? 3 : 2);
+    size_t i = 0;
+    if (negative) out[i++] = '-';
+    if (fixed <= scientific) {
+        if (exp10 >= 15 && n <= exp10)
+            return static_cast<size_t>(std::snprintf(out, kMaxDoubleChars, "%.0f", v));
+        if (exp10 < 0) {
+            out[i++] = '0';
+            out[i++] = '.';
+            for (int z = -1; z > exp10; --z) out[i++] = '0';
+            for (int d = 0; d < n; ++d) out[i++] = digits[d];
+        }
+        else {
+            for (int d = 0; d <= exp10 || d < n; ++d) {
+                if (d == exp10 + 1) out[i++] = '.';
+                out[i++] = d < n ? digits[d] : '0';
+            }
+        }
+        return i;
+    }
+    out[i++] = digits[0];
+    if (n > 1) {
+        out[i++] = '.';
+        for (int d = 1; d < n; ++d) out[i++] = digits[d];
+    }
+    out[i++] = 'e';
+    out[i++] = exp10 < 0 ? '-' : '+';
+    if (exp_abs >= 100) {
+        write_uint(out + i, static_cast<uint64_t>(exp_abs), 3);
+        return i + 3;
+    }
+    out[i++] = kDigitPairs[exp_abs * 2];
+    out[i++] = kDigitPairs[exp_abs * 2 + 1];
+    return i;
+}
+
+// Быстрый путь Клингера для записи длины len (см. scan_double): мантисса
+// до 2^53 и |порядок| <= 22 — тогда m * 10^e и m / 10^e округляются
+// один раз и совпадают с результатом strtod. false — нужен strtod.
+inline bool parse_double_fast(const char* s, size_t len, double& out) {
+    size_t i = 0;
+    bool negative = s[0] == '-';
+    if (negative) i = 1;
+    uint64_t m = 0;
+    int digits = 0, exp10 = 0;
+    bool fraction = false;
+    for (; i < len; ++i) {
+        if (s[i] == '.') { fraction = true; continue; }
+        unsigned d = static_cast<unsigned char>(s[i]) - static_cast<unsigned>('0');
+        if (d > 9) break;
+        if (fraction) --exp10;
+        if (m == 0 && d == 0) continue; // ведущие нули
+        if (++digits > 16) return false;
+        m = m * 10 + d;
+    }
+    if (i < len) { // порядок: e [+-] цифры
+        ++i;
+        bool exp_negative = s[i] == '-';
+        if (s[i] == '+' || s[i] == '-') ++i;
+        if (len - i > 3) return false;
+        int e = 0;
+        for (; i < len; ++i) e = e * 10 + (s[i] - '0');
+        exp10 += exp_negative ? -e : e;
+    }
+    if (m > (uint64_t(1) << 53)) return false;
+    if (m == 0) exp10 = 0;
+    if (exp10 < -22 || exp10 > 22) return false;
+    double v = static_cast<double>(m);
+    v = exp10 < 0 ? v / kPow10[-exp10] : v * kPow10[exp10];
+    out = negative ? -v : v;
+    return true;
+}
+#endif
+
+// Кратчайшая запись v, читающаяся обратно в то же значение; пишет в out
+// не больше kMaxDoubleChars символов и возвращает их число
+inline size_t format_double(char* out, double v) {
+    if (v != v) {
+        out[0] = 'n'; out[1] = 'a'; out[2] = 'n';
+        return 3;
+    }
+    if (v == std::numeric_limits<double>::infinity() || v == -std::numeric_limits<double>::infinity()) {
+        size_t i = 0;
+        if (v < 0) out[i++] = '-';
+        out[i] = 'i'; out[i + 1] = 'n'; out[i + 2] = 'f';
+        return i + 3;
+    }
+#if defined(IND3_TO_CHARS)
+    return static_cast<size_t>(std::to_chars(out, out + kMaxDoubleChars, v).ptr - out);
+#else
+    // Цифры и порядок ищутся отдельно от вида записи; разделитель локали
+    // в snprintf на результат не влияет
+    char digits[20];
+    unsigned count = 0;
+    int exp10 = 0;
+    bool negative = v < 0;
+    if (!shortest_digits_fast(negative ? -v : v, digits, count, exp10))
+        negative = shortest_digits(v, digits, count, exp10);
+    return write_shortest(out, v, negative, digits, count, exp10);
+#endif
+}
+
+// Разобрать число в начале s[0, n) (см. format_double). Возвращает число
+// прочитанных символов; 0 — числа нет или оно вне диапазона double.
+inline size_t parse_double(const char* s, size_t n, double& out) {
+#if defined(IND3_TO_CHARS)
+    double v;
+    std::from_chars_result r = std::from_chars(s, s + n, v);
+    if (r.ec != std::errc()) return 0;
+    out = v;
+    return static_cast<size_t>(r.ptr - s);
+#else
+    size_t len = scan_double(s, n);
+    if (len == 0) return 0;
+    if (static_cast<unsigned>(s[len - 1] - '0') < 10 || s[len - 1] == '.') {
+        if (parse_double_fast(s, len, out)) return len; // не inf / nan
+    }
+    // strtod нужен '\0' в конце и разделитель локали вместо '.'
+    char local[64];
+    std::vector<char> heap;
+    char* buf = local;
+    if (len >= sizeof(local)) {
+        heap.resize(len + 1);
+        buf = heap.data();
+    }
+    char point = locale_point();
+    for (size_t i = 0; i < len; ++i) buf[i] = (s[i] == '.') ? point : s[i];
+    buf[len] = '\0';
+    double v = std::strtod(buf, nullptr);
+    bool finite_text = static_cast<unsigned>(s[s[0] == '-'] - '0') < 10 || s[s[0] == '-'] == '.';
+    if (finite_text && (v == std::numeric_limits<double>::infinity() || v == -std::numeric_limits<double>::infinity()))
+        return 0; // переполнение
+    out = v;
+    return len;
+#endif
+}
+
+} // namespace number
+
+// -------------------- UTF-8 --------------------
+// Декодирование и кодирование кодовых точек поверх simd::utf8_valid.
+// Порядок байтов UTF-8 совпадает с порядком кодовых точек, поэтому compare
+// и compare_lex для корректного UTF-8 уже сравнивают по кодовым точкам.
+namespace utf8 {
+
+// Чем заменяется некорректная последовательность при декодировании
+const char32_t kReplacement = 0xFFFD;
+
+// Позиция первого байта некорректной последовательности, либо n
+inline size_t first_invalid(const char* s, size_t n) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i < n) {
+        size_t len = simd::utf8_char_length(p + i, n - i);
+        if (!len) return i;
+        i += len;
+    }
+    return n;
+}
+
+// Число кодовых точек корректного UTF-8: все байты, кроме продолжений 10xxxxxx
+inline size_t count(const char* s, size_t n) {
+    static const simd::ByteRanges kContinuation = { { 0x80 }, { 0x3F }, 1 };
+    return n - simd::count_ranges(s, n, kContinuation);
+}
+
+// Кодовая точка в начале s[0, n) (n > 0); len — её длина в байтах.
+// Некорректный байт декодируется как kReplacement длиной 1.
+inline char32_t decode(const char* s, size_t n, size_t& len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    if (p[0] < 0x80) { len = 1; return p[0]; }
+    len = simd::utf8_char_length(p, n);
+    switch (len) {
+    case 2: return (char32_t(p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+    case 3: return (char32_t(p[0] & 0x0F) << 12) | (char32_t(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+    case 4: return (char32_t(p[0] & 0x07) << 18) | (char32_t(p[1] & 0x3F) << 12) |
+                   (char32_t(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+    }
+    len = 1;
+    return kReplacement;
+}
+
+// Записать cp в out (до 4 байт) и вернуть число байт. Суррогаты
+// и значения больше U+10FFFF записываются как kReplacement.
+inline size_t encode(char32_t cp, char* out) {
+    if (cp < 0x80) { out[0] = static_cast<char>(cp); return 1; }
+    if (cp < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (cp >> 6));
+        out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = kReplacement;
+    if (cp < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (cp >> 12));
+        out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (cp >> 18));
+    out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+} // namespace utf8
+
+class String;
+class SplitRange;
+class CodePointRange;
+class MappedFile;
+template <class L, class R> class StringConcat;
+
+// -------------------- Классы символов --------------------
+// Классы ASCII как у <cctype> в локали "C"; байты >= 0x80 не входят ни в один.
+// Класс — объединение не более четырёх диапазонов байт, которое
+// simd::count_ranges проверяет за один векторный проход.
+enum class CharClass { Digit, XDigit, Lower, Upper, Alpha, Alnum, Space, Punct };
+
+inline const simd::ByteRanges& char_class_ranges(CharClass cls) {
+    static const simd::ByteRanges kTable[] = {
+        { { '0' }, { 9 }, 1 },                           // Digit
+        { { '0', 'A', 'a' }, { 9, 5, 5 }, 3 },           // XDigit
+        { { 'a' }, { 25 }, 1 },                          // Lower
+        { { 'A' }, { 25 }, 1 },                          // Upper
+        { { 'A', 'a' }, { 25, 25 }, 2 },                 // Alpha
+        { { '0', 'A', 'a' }, { 9, 25, 25 }, 3 },         // Alnum
+        { { '\t', ' ' }, { 4, 0 }, 2 },                  // Space: \t \n \v \f \r и пробел
+        { { '!', ':', '[', '{' }, { 14, 6, 5, 3 }, 4 },  // Punct: !-/ :-@ [-` {-~
+    };
+    return kTable[static_cast<int>(cls)];
+}
+
+// -------------------- StringView --------------------
+// Невладеющий взгляд на последовательность символов: указатель + длина.
+// Ничего не выделяет и не копирует; данные должны жить дольше view.
+// В отличие от String, view не обязан заканчиваться '\0'.
+class StringView {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    StringView() : data_(""), length_(0) {}
+    StringView(const char* str) : data_(str ? str : ""), length_(str ? simd::str_length(str) : 0) {}
+    StringView(const char* str, size_t len) : data_(len ? str : ""), length_(len) {}
+    StringView(const String& s); // определён после String
+
+    const char* data() const { return data_; }
+    size_t length() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    // Без проверки границ, как и у std::string_view
+    char operator[](size_t index) const { return data_[index]; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + length_; }
+
+    // Подстрока [pos, pos + count); count обрезается по концу строки.
+    // pos > length() — std::out_of_range.
+    StringView substr(size_t pos, size_t count = npos) const {
+        if (pos > length_) throw std::out_of_range("StringView::substr: position out of range");
+        size_t rest = length_ - pos;
+        return StringView(data_ + pos, count < rest ? count : rest);
+    }
+
+    // Позиция первого вхождения ch начиная с pos, либо npos
+    size_t find(char ch, size_t pos = 0) const {
+        if (pos >= length_) return npos;
+        size_t i = simd::find_byte(data_ + pos, length_ - pos, ch);
+        return (i == length_ - pos) ? npos : pos + i;
+    }
+
+    // Позиция первого вхождения needle начиная с pos, либо npos
+    // (алгоритм выбирается по длине needle, см. search::Searcher)
+    size_t find(StringView needle, size_t pos = 0) const {
+        return search::Searcher(needle.data_, needle.length_).find(data_, length_, pos);
+    }
+
+    bool contains(char ch) const { return find(ch) != npos; }
+    bool contains(StringView needle) const { return find(needle) != npos; }
+
+    // Число непересекающихся вхождений needle (как str.count в Python;
+    // пустой образец встречается length() + 1 раз)
+    size_t count(StringView needle) const {
+        search::Searcher searcher(needle.data_, needle.length_);
+        size_t step = needle.length_ ? needle.length_ : 1;
+        size_t n = 0;
+        for (size_t i = searcher.find(data_, length_); i != npos; i = searcher.find(data_, length_, i + step)) ++n;
+        return n;
+    }
+
+    // Позиции всех непересекающихся вхождений needle по возрастанию
+    std::vector<size_t> find_all(StringView needle) const {
+        std::vector<size_t> positions;
+        search::Searcher searcher(needle.data_, needle.length_);
+        size_t step = needle.length_ ? needle.length_ : 1;
+        for (size_t i = searcher.find(data_, length_); i != npos; i = searcher.find(data_, length_, i + step))
+            positions.push_back(i);
+        return positions;
+    }
+
+    // Позиция последнего вхождения ch не правее pos, либо npos
+    size_t rfind(char ch, size_t pos = npos) const {
+        if (length_ == 0) return npos;
+        size_t i = (pos < length_) ? pos : length_ - 1;
+        for (;; --i) {
+            if (data_[i] == ch) return i;
+            if (i == 0) return npos;
+        }
+    }
+
+    // Позиция последнего вхождения needle, начинающегося не правее pos, либо npos
+    size_t rfind(StringView needle, size_t pos = npos) const {
+        if (needle.length_ > length_) return npos;
+        size_t i = length_ - needle.length_;
+        if (pos < i) i = pos;
+        for (;; --i) {
+            if (simd::first_mismatch(data_ + i, needle.data_, needle.length_) == needle.length_) return i;
+            if (i == 0) return npos;
+        }
+    }
+
+    bool starts_with(StringView prefix) const {
+        return prefix.length_ <= length_ &&
+               simd::first_mismatch(data_, prefix.data_, prefix.length_) == prefix.length_;
+    }
+    bool ends_with(StringView suffix) const {
+        return suffix.length_ <= length_ &&
+               simd::first_mismatch(data_ + length_ - suffix.length_, suffix.data_, suffix.length_) == suffix.length_;
+    }
+
+    // Лексикографическое сравнение по байтам без знака: <0, 0, >0
+    int compare(StringView other) const {
+        size_t n = (length_ < other.length_) ? length_ : other.length_;
+        size_t i = simd::first_mismatch(data_, other.data_, n);
+        if (i < n) {
+            unsigned char a = static_cast<unsigned char>(data_[i]);
+            unsigned char b = static_cast<unsigned char>(other.data_[i]);
+            return (a < b) ? -1 : 1;
+        }
+        if (length_ == other.length_) return 0;
+        return (length_ < other.length_) ? -1 : 1;
+    }
+
+    bool operator==(StringView other) const {
+        return length_ == other.length_ &&
+               simd::first_mismatch(data_, other.data_, length_) == length_;
+    }
+    bool operator!=(StringView other) const { return !(*this == other); }
+    bool operator<(StringView other) const { return compare(other) < 0; }
+    bool operator>(StringView other) const { return compare(other) > 0; }
+
+    // То же, что compare, но ASCII-буквы сравниваются без учёта регистра
+    // (различающиеся байты сравниваются после приведения к нижнему регистру)
+    int compare_icase(StringView other) const {
+        size_t n = (length_ < other.length_) ? length_ : other.length_;
+        size_t i = simd::first_mismatch_icase(data_, other.data_, n);
+        if (i < n) {
+            unsigned char a = simd::fold_ascii(static_cast<unsigned char>(data_[i]));
+            unsigned char b = simd::fold_ascii(static_cast<unsigned char>(other.data_[i]));
+            return (a < b) ? -1 : 1;
+        }
+        if (length_ == other.length_) return 0;
+        return (length_ < other.length_) ? -1 : 1;
+    }
+
+    bool equals_icase(StringView other) const {
+        return length_ == other.length_ &&
+               simd::first_mismatch_icase(data_, other.data_, length_) == length_;
+    }
+
+    // Число символов класса cls (один векторный проход)
+    size_t count_if(CharClass cls) const { return simd::count_ranges(data_, length_, char_class_ranges(cls)); }
+    // Все ли символы принадлежат классу cls (для пустой строки — true)
+    bool all_of(CharClass cls) const { return count_if(cls) == length_; }
+
+    // Число в начале строки (как std::from_chars): возвращает число прочитанных
+    // символов, 0 — числа нет или переполнение (out тогда не меняется).
+    // Всё ли прочитано: view.parse_int(x) == view.length().
+    template <class Int>
+    size_t parse_int(Int& out) const {
+        static_assert(std::is_integral<Int>::value && !std::is_same<Int, bool>::value, "parse_int: integer type expected");
+        return number::parse_int(data_, length_, out);
+    }
+    size_t parse_double(double& out) const { return number::parse_double(data_, length_, out); }
+
+    // UTF-8: проверка (векторная), число кодовых точек и их обход:
+    // for (char32_t cp : view.code_points()); некорректные байты дают U+FFFD
+    bool is_valid_utf8() const { return simd::utf8_valid(data_, length_); }
+    bool is_ascii() const { return count_if_byte_range(0x80, 0x7F) == 0; }
+    size_t code_point_count() const { return utf8::count(data_, length_); }
+    CodePointRange code_points() const;
+
+    // Разбиение по разделителю: for (StringView field : view.split(',')).
+    // Как split в Python: "a,,b" -> "a", "", "b"; пустая строка -> одно пустое поле.
+    SplitRange split(char delim) const;
+
+private:
+    size_t count_if_byte_range(unsigned char lo, unsigned char span) const {
+        simd::ByteRanges r = { { lo }, { span }, 1 };
+        return simd::count_ranges(data_, length_, r);
+    }
+
+    const char* data_;
+    size_t length_;
+};
+
+const size_t StringView::npos;
+
+// Итератор по полям StringView::split
+class SplitIterator {
+public:
+    SplitIterator() : delim_(0), has_rest_(false), done_(true) {}
+    SplitIterator(StringView text, char delim) : rest_(text), delim_(delim), has_rest_(true), done_(false) {
+        advance();
+    }
+
+    StringView operator*() const { return field_; }
+    const StringView* operator->() const { return &field_; }
+    SplitIterator& operator++() { advance(); return *this; }
+    bool operator==(const SplitIterator& other) const { return done_ == other.done_; }
+    bool operator!=(const SplitIterator& other) const { return !(*this == other); }
+
+private:
+    void advance() {
+        if (!has_rest_) { done_ = true; return; } // последнее поле уже выдано
+        size_t pos = rest_.find(delim_);
+        if (pos == StringView::npos) {
+            field_ = rest_;
+            has_rest_ = false;
+        }
+        else {
+            field_ = rest_.substr(0, pos);
+            rest_ = rest_.substr(pos + 1);
+        }
+    }
+
+    StringView rest_;  // ещё не разобранная часть
+    StringView field_; // текущее поле
+    char delim_;
+    bool has_rest_;    // осталось ли что выдавать (в том числе пустое последнее поле)
+    bool done_;
+};
+
+class SplitRange {
+public:
+    SplitRange(StringView text, char delim) : text_(text), delim_(delim) {}
+    SplitIterator begin() const { return SplitIterator(text_, delim_); }
+    SplitIterator end() const { return SplitIterator(); }
+
+private:
+    StringView text_;
+    char delim_;
+};
+
+inline SplitRange StringView::split(char delim) const { return SplitRange(*this, delim); }
+
+// Обход кодовых точек UTF-8 (см. StringView::code_points)
+class CodePointIterator {
+public:
+    CodePointIterator(const char* pos, const char* end) : pos_(pos), end_(end), cp_(0), len_(0) { decode(); }
+
+    char32_t operator*() const { return cp_; }
+    CodePointIterator& operator++() { pos_ += len_; decode(); return *this; }
+    bool operator==(const CodePointIterator& other) const { return pos_ == other.pos_; }
+    bool operator!=(const CodePointIterator& other) const { return !(*this == other); }
+
+    // Байты текущей кодовой точки в исходной строке
+    StringView bytes() const { return StringView(pos_, len_); }
+
+private:
+    void decode() {
+        if (pos_ != end_) cp_ = utf8::decode(pos_, static_cast<size_t>(end_ - pos_), len_);
+    }
+
+    const char* pos_;
+    const char* end_;
+    char32_t cp_;
+    size_t len_;
+};
+
+class CodePointRange {
+public:
+    explicit CodePointRange(StringView text) : text_(text) {}
+    CodePointIterator begin() const { return CodePointIterator(text_.begin(), text_.end()); }
+    CodePointIterator end() const { return CodePointIterator(text_.end(), text_.end()); }
+
+private:
+    StringView text_;
+};
+
+inline CodePointRange StringView::code_points() const { return CodePointRange(*this); }
+
+// Политика роста ёмкости при дописывании (push_back, operator+=)
+struct GrowthPolicy {
+    unsigned num; // множитель роста num / den: 2/1 — удвоение, 3/2 — в 1.5 раза
+    unsigned den;
+    bool round_to_size_class; // подгонять размер выделения под класс аллокатора
+
+    static GrowthPolicy doubling() { GrowthPolicy p = { 2, 1, true }; return p; }
+    static GrowthPolicy one_and_half() { GrowthPolicy p = { 3, 2, true }; return p; }
+
+    // Новая ёмкость для строки ёмкости cap, которой нужно needed символов
+    size_t next_capacity(size_t cap, size_t needed) const {
+        size_t grown = cap / den * num + cap % den * num / den;
+        if (grown < needed) grown = needed;
+        return round_to_size_class ? round_capacity(grown) : grown;
+    }
+
+    // Наибольшая ёмкость в том же классе размеров, что и cap (буфер = cap + 1 байт):
+    // до 4 КБ классы — степени двойки (как в PoolResource и бинах malloc),
+    // дальше — кратные 4 КБ страницы
+    static size_t round_capacity(size_t cap) {
+        size_t bytes = cap + 1;
+        if (bytes <= 4096) {
+            size_t sz = 16;
+            while (sz < bytes) sz *= 2;
+            bytes = sz;
+        }
+        else {
+            bytes = align_up(bytes, 4096);
+        }
+        return bytes - 1;
+    }
+};
+
+// Какие байты учитывает unique_chars_with
+enum class CharRange {
+    Ascii,    // только 0..127 (исходное поведение)
+    AllBytes  // все значения 0..255
+};
+
+// Множество значений байта (0..255) в виде 256-битной маски
+class ByteSet {
+public:
+    ByteSet() { for (int i = 0; i < 4; ++i) bits_[i] = 0; }
+
+    static ByteSet all() { return ~ByteSet(); }
+    static ByteSet ascii() {
+        ByteSet s;
+        s.bits_[0] = s.bits_[1] = ~0ULL;
+        return s;
+    }
+    // Множество байтов с ненулевым счётчиком в гистограмме
+    static ByteSet from_histogram(const size_t hist[256]) {
+        ByteSet s;
+        for (size_t c = 0; c < 256; ++c)
+            s.bits_[c >> 6] |= static_cast<uint64_t>(hist[c] != 0) << (c & 63);
+        return s;
+    }
+
+    void insert(unsigned char c) { bits_[c >> 6] |= 1ULL << (c & 63); }
+    bool contains(unsigned char c) const { return ((bits_[c >> 6] >> (c & 63)) & 1) != 0; }
+
+    ByteSet operator~() const {
+        ByteSet r;
+        for (int i = 0; i < 4; ++i) r.bits_[i] = ~bits_[i];
+        return r;
+    }
+    ByteSet operator&(const ByteSet& o) const {
+        ByteSet r;
+        for (int i = 0; i < 4; ++i) r.bits_[i] = bits_[i] & o.bits_[i];
+        return r;
+    }
+    ByteSet operator|(const ByteSet& o) const {
+        ByteSet r;
+        for (int i = 0; i < 4; ++i) r.bits_[i] = bits_[i] | o.bits_[i];
+        return r;
+    }
+
+private:
+    uint64_t bits_[4];
+};
+
+// Множество кодовых точек для unique_code_points_with. U+0000..U+07FF (ASCII,
+// латиница, кириллица, греческий, иврит, арабский) — битовая маска на 256 байт
+// без выделений; остальные — открытая адресация в std::vector, которая
+// выделяется только при первой такой точке.
+class CodePointSet {
+public:
+    CodePointSet() : size_(0) { for (int i = 0; i < kBitmapWords; ++i) bits_[i] = 0; }
+
+    void insert(char32_t cp) {
+        if (cp < kBitmapLimit) { bits_[cp >> 6] |= 1ULL << (cp & 63); return; }
+        if ((size_ + 1) * 4 > table_.size() * 3) rehash(table_.empty() ? 16 : table_.size() * 2);
+        insert_hashed(cp);
+    }
+
+    bool contains(char32_t cp) const {
+        if (cp < kBitmapLimit) return ((bits_[cp >> 6] >> (cp & 63)) & 1) != 0;
+        if (table_.empty()) return false;
+        size_t mask = table_.size() - 1;
+        for (size_t i = hash(cp) & mask;; i = (i + 1) & mask) {
+            if (table_[i] == cp) return true;
+            if (table_[i] == kEmpty) return false;
+        }
+    }
+
+    // Добавить все кодовые точки текста (некорректные байты — как U+FFFD)
+    void insert_text(const char* s, size_t n) {
+        for (size_t i = 0; i < n;) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c < 0x80) { bits_[c >> 6] |= 1ULL << (c & 63); ++i; continue; }
+            size_t len;
+            insert(utf8::decode(s + i, n - i, len));
+            i += len;
+        }
+    }
+
+private:
+    static const int kBitmapWords = 32;
+    static const char32_t kBitmapLimit = 0x800;
+    static const char32_t kEmpty = 0; // 0 попадает в маску, поэтому в таблице свободен
+
+    static size_t hash(char32_t cp) {
+        uint32_t h = static_cast<uint32_t>(cp) * 0x9E3779B1u;
+        return h ^ (h >> 16);
+    }
+
+    void insert_hashed(char32_t cp) {
+        size_t mask = table_.size() - 1;
+        for (size_t i = hash(cp) & mask;; i = (i + 1) & mask) {
+            if (table_[i] == cp) return;
+            if (table_[i] == kEmpty) { table_[i] = cp; ++size_; return; }
+        }
+    }
+
+    void rehash(size_t new_size) {
+        std::vector<char32_t> old(new_size, kEmpty);
+        old.swap(table_);
+        size_ = 0;
+        for (char32_t cp : old)
+            if (cp != kEmpty) insert_hashed(cp);
+    }
+
+    uint64_t bits_[kBitmapWords];
+    std::vector<char32_t> table_; // размер — степень двойки, заполнение не больше 3/4
+    size_t size_;
+};
+
+const int CodePointSet::kBitmapWords;
+const char32_t CodePointSet::kBitmapLimit;
+const char32_t CodePointSet::kEmpty;
 
 // Упрощённый класс String, работающий со C-style строками.
 // Реализованы: конструкторы, деструктор, копирование, перемещение,
 // присваивания, доступ по индексу с проверкой, reserve/push_back,
 // операции +, +=, clear, сравнения и новая функция unique_chars_with.
+//
+// Короткие строки (до kLocalCapacity символов) хранятся прямо внутри объекта
+// (small-string optimization): память под них не выделяется вовсе.
+// data_ всегда указывает на актуальный буфер — либо на local_buf_, либо на кучу.
+//
+// Память под длинные строки берётся из MemoryResource (по умолчанию new/delete).
+// Ресурс "следует за буфером": копия берёт ресурс оригинала, при перемещении
+// и swap ресурс переходит вместе с буфером.
+//
+// При IND3_CACHE_HASH строка запоминает свой хеш (hash_), а любое изменение
+// содержимого сбрасывает его через invalidate_hash().
+//
+// Копирование при записи (COW) включается для отдельной строки вызовом
+// make_shareable(): её буфер в куче получает атомарный счётчик ссылок, и
+// копирование такой строки лишь увеличивает счётчик. Любой изменяющий метод
+// (неконстантные operator[]/at/data/begin/end, push_back, +=, clear, reserve...)
+// сначала отделяет собственную копию, если буфер используется ещё кем-то.
+// Неконстантные operator[]/at/unchecked_at/data/begin/end отдают ссылку
+// на символы, через которую строку можно менять и позже, поэтому буфер
+// после них помечается неразделяемым: копии такой строки копируют символы.
+// Пометка снимается следующим изменяющим методом (push_back, +=, reserve...),
+// который, как и у std::string, делает выданные ссылки недействительными.
+// Потоки: разные объекты String, делящие один буфер, можно независимо
+// копировать, читать, изменять и удалять из разных потоков — счётчик
+// атомарный, а запись идёт только в буфер, которым объект владеет единолично.
+// Один и тот же объект String, как и раньше, нельзя одновременно изменять
+// и читать из разных потоков. Короткие строки в COW не участвуют.
 class String {
 private:
-    char* data_;       // указатель на буфер символов (включая нуль-терминатор)
-    size_t length_;    // длина строки (без нуль-терминатора)
-    size_t capacity_;  // ёмкость буфера
+    // Максимальная длина строки, которая помещается во внутренний буфер
+    static const size_t kLocalCapacity = 15;
+
+    char* data_;       // указатель на буфер символов (включая нуль-терминатор)
+    size_t length_;    // длина строки (без нуль-терминатора)
+    union {
+        size_t capacity_;                     // ёмкость буфера в куче
+        char local_buf_[kLocalCapacity + 1];  // внутренний буфер для коротких строк
+    };
+    MemoryResource* res_; // откуда берётся память под буфер в куче
+    bool shared_ = false; // режим COW: буфер в куче со счётчиком ссылок
+#if defined(IND3_CACHE_HASH)
+    mutable uint64_t hash_ = 0; // закешированный хеш; 0 — ещё не посчитан
+#endif
+
+    // Сбросить закешированный хеш (вызывается при любом изменении символов)
+    void invalidate_hash() noexcept {
+#if defined(IND3_CACHE_HASH)
+        hash_ = 0;
+#endif
+    }
+
+    // Заголовок COW-буфера; символы следуют сразу за ним
+    struct SharedHeader {
+        std::atomic<size_t> refs;
+        bool unshareable; // выдана ссылка на символы: копии не делят буфер
+        SharedHeader() : refs(1), unshareable(false) {}
+    };
+    static const size_t kSharedHeaderSize = (sizeof(SharedHeader) + alignof(std::max_align_t) - 1) &
+                                            ~(alignof(std::max_align_t) - 1);
+
+    static SharedHeader* header_of(char* buf) {
+        return reinterpret_cast<SharedHeader*>(buf - kSharedHeaderSize);
+    }
+
+    // Выделить буфер ёмкости cap (cap символов + 1 для '\0') из res_;
+    // при shared — вместе с заголовком-счётчиком (refs = 1).
+    // Может бросить std::bad_alloc при неудаче выделения.
+    char* allocate_raw(size_t cap, bool shared) {
+        char* buf;
+        if (shared) {
+            char* raw = static_cast<char*>(res_->allocate(kSharedHeaderSize + cap + 1));
+            new (raw) SharedHeader();
+            buf = raw + kSharedHeaderSize;
+            IND3_STAT(kBytesAllocated, kSharedHeaderSize + cap + 1);
+        }
+        else {
+            buf = static_cast<char*>(res_->allocate(cap + 1)); // выделяем cap + 1 байт
+            IND3_STAT(kBytesAllocated, cap + 1);
+        }
+        IND3_STAT(kAllocations, 1);
+        buf[0] = '\0'; // делаем корректной пустую C-строку
+        return buf;
+    }
+
+    char* allocate_buffer(size_t cap) { return allocate_raw(cap, shared_); }
+
+    // Освободить буфер buf ёмкости cap; COW-буфер — только с последней ссылкой.
+    // wasted — неиспользованная ёмкость, учитывается, только если память
+    // действительно освобождена.
+    void release_heap(char* buf, size_t cap, bool shared, size_t wasted = 0) noexcept {
+        (void)wasted; // без IND3_STATS не нужен
+        if (!shared) {
+            res_->deallocate(buf, cap + 1);
+            IND3_STAT(kFrees, 1);
+            IND3_STAT(kWastedCapacity, wasted);
+            return;
+        }
+        SharedHeader* h = header_of(buf);
+        if (h->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        h->~SharedHeader();
+        res_->deallocate(reinterpret_cast<char*>(h), kSharedHeaderSize + cap + 1);
+        IND3_STAT(kFrees, 1);
+        IND3_STAT(kWastedCapacity, wasted);
+    }
+
+    // Буфер в куче, который делят несколько строк?
+    bool buffer_is_shared() const {
+        return shared_ && !is_local() && header_of(data_)->refs.load(std::memory_order_acquire) > 1;
+    }
+
+    // Подготовиться к изменению символов: отделить собственную копию общего
+    // COW-буфера (может бросить std::bad_alloc) и сбросить закешированный хеш.
+    // Ранее выданные ссылки на символы теперь недействительны — буфер снова
+    // можно делить с копиями.
+    void prepare_write() {
+        if (buffer_is_shared()) {
+            char* buf = allocate_buffer(capacity_); // может бросить
+            simd::copy_bytes(buf, data_, length_ + 1);
+            IND3_STAT(kBytesCopied, length_);
+            release_buffer();
+            data_ = buf;
+        }
+        else if (shared_ && !is_local()) {
+            header_of(data_)->unshareable = false;
+        }
+        invalidate_hash();
+    }
+
+    // Отдать наружу изменяемую ссылку на символы: собственный буфер, который
+    // копии уже не разделят — иначе запись через ссылку увидели бы и они
+    void prepare_leak() {
+        prepare_write(); // может бросить
+        if (shared_ && !is_local()) header_of(data_)->unshareable = true;
+    }
+
+    // Строка хранится во внутреннем буфере?
+    bool is_local() const { return data_ == local_buf_; }
+
+    // Перейти в пустое состояние на внутреннем буфере (без выделения памяти).
+    // Старый буфер не освобождается — это обязанность вызывающего.
+    void set_local_empty() noexcept {
+        data_ = local_buf_;
+        length_ = 0;
+        local_buf_[0] = '\0';
+        invalidate_hash();
+    }
+
+    // Обеспечить ёмкость не меньше needed, расширяясь по политике роста
+    void grow_for(size_t needed) {
+        if (needed > capacity()) reserve(growth_policy_slot().next_capacity(capacity(), needed));
+    }
+
+    static GrowthPolicy& growth_policy_slot() {
+        static GrowthPolicy policy = GrowthPolicy::doubling();
+        return policy;
+    }
+
+    // Освободить буфер в куче (внутренний буфер освобождать не нужно)
+    void release_buffer() noexcept {
+        if (is_local()) return;
+        release_heap(data_, capacity_, shared_, capacity_ - length_);
+    }
+
+    // Инициализировать пустой объект копией len символов из src.
+    // Если строка короткая — копируем во внутренний буфер, иначе выделяем память.
+    void init_from(const char* src, size_t len) {
+        if (len <= kLocalCapacity) {
+            data_ = local_buf_;
+        }
+        else {
+            data_ = allocate_buffer(len); // может бросить
+            capacity_ = len;
+        }
+        simd::copy_bytes(data_, src, len);
+        IND3_STAT(kBytesCopied, len);
+        data_[len] = '\0';
+        length_ = len;
+    }
+
+    // Забрать содержимое other (который после этого становится пустым).
+    // *this должен быть без буфера в куче. Ресурс переходит вместе с буфером.
+    // Память не выделяется.
+    void steal_from(String& other) noexcept {
+        if (other.is_local()) {
+            data_ = local_buf_;
+            simd::copy_bytes(local_buf_, other.local_buf_, other.length_ + 1);
+        }
+        else {
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+        }
+        length_ = other.length_;
+        res_ = other.res_;
+        shared_ = other.shared_;
+#if defined(IND3_CACHE_HASH)
+        hash_ = other.hash_;
+#endif
+        other.set_local_empty();
+    }
+
+    // Вспомогательная функция: лексикографическое сравнение
+    // (первое различие ищется векторно, см. simd::first_mismatch)
+    int compare_lex(StringView other) const {
+        IND3_STAT(kCompare, 1);
+        return StringView(data_, length_).compare(other);
+    }
+
+    // Копия строки, преобразованная convert(dst, src, n) при переносе в новый буфер
+    String case_copy(void (*convert)(char*, const char*, size_t)) const {
+        String out(res_);
+        const char* src = data_;
+        out.resize_and_overwrite(length_, [src, convert](char* dst, size_t n) {
+            convert(dst, src, n);
+            return n;
+        });
+        return out;
+    }
+
+    // Дописать n байт из src. src может указывать внутрь собственного буфера:
+    // тогда после перевыделения он пересчитывается по смещению.
+    void append_bytes(const char* src, size_t n) {
+        size_t needed = length_ + n;
+        std::less_equal<const char*> le;
+        bool inside = le(data_, src) && le(src, data_ + length_);
+        size_t offset = inside ? static_cast<size_t>(src - data_) : 0;
+        grow_for(needed); // может бросить
+        prepare_write();  // может бросить
+        if (inside) src = data_ + offset;
+        simd::copy_bytes(data_ + length_, src, n);
+        IND3_STAT(kBytesCopied, n);
+        length_ = needed;
+        data_[length_] = '\0';
+    }
+
+public:
+    // -------------------- Конструкторы / деструктор --------------------
+
+    // Конструктор по умолчанию: пустая строка (во внутреннем буфере)
+    String()
+        : data_(local_buf_), length_(0), res_(MemoryResource::default_resource())
+    {
+        local_buf_[0] = '\0';
+    }
+
+    // Пустая строка, которая будет брать память из res
+    explicit String(MemoryResource* res)
+        : data_(local_buf_), length_(0), res_(res)
+    {
+        local_buf_[0] = '\0';
+    }
+
+    // Конструктор из C-строки (const char*); память — из res
+    String(const char* str, MemoryResource* res = MemoryResource::default_resource())
+        : data_(local_buf_), length_(0), res_(res)
+    {
+        local_buf_[0] = '\0';
+        if (!str) return; // nullptr трактуем как пустую строку
+
+        // вычисляем длину вручную (без <cstring>)
+        size_t len = simd::str_length(str);
+
+        init_from(str, len); // может бросить
+    }
+
+    // Копия символов view (explicit: копирование должно быть видно в коде)
+    explicit String(StringView view, MemoryResource* res = MemoryResource::default_resource())
+        : data_(local_buf_), length_(0), res_(res)
+    {
+        init_from(view.data(), view.length()); // может бросить
+    }
+
+    // Копирующий конструктор (глубокое копирование в ресурсе оригинала)
+    // Для COW-строки копия лишь увеличивает счётчик ссылок буфера, если
+    // на символы оригинала не выдана изменяемая ссылка.
+    String(const String& other)
+        : data_(local_buf_), length_(0), res_(other.res_), shared_(other.shared_)
+    {
+        IND3_STAT(kCopyConstruct, 1);
+        if (other.shared_ && !other.is_local() && !header_of(other.data_)->unshareable) {
+            header_of(other.data_)->refs.fetch_add(1, std::memory_order_relaxed);
+            data_ = other.data_;
+            length_ = other.length_;
+            capacity_ = other.capacity_;
+        }
+        else {
+            init_from(other.data_, other.length_); // может бросить
+        }
+#if defined(IND3_CACHE_HASH)
+        hash_ = other.hash_;
+#endif
+    }
+
+    // Глубокая копия other, размещённая в ресурсе res
+    String(const String& other, MemoryResource* res)
+        : data_(local_buf_), length_(0), res_(res), shared_(other.shared_)
+    {
+        IND3_STAT(kCopyConstruct, 1);
+        init_from(other.data_, other.length_); // может бросить
+    }
+
+    // Перемещающий конструктор: забираем буфер other (или копируем
+    // внутренний буфер), other остаётся пустым. Память не выделяется,
+    // поэтому конструктор noexcept — std::vector<String> перемещает
+    // элементы при росте, а не копирует их.
+    String(String&& other) noexcept
+        : data_(local_buf_), length_(0), res_(other.res_)
+    {
+        IND3_STAT(kMoveConstruct, 1);
+        steal_from(other);
+    }
+
+    // Деструктор: освобождаем память
+    ~String() {
+        release_buffer();
+    }
+
+    // -------------------- Доступ и операторы --------------------
+
+    size_t length() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    // Текущая ёмкость (для внутреннего буфера — kLocalCapacity)
+    size_t capacity() const { return is_local() ? kLocalCapacity : capacity_; }
+
+    // Политика роста для push_back и operator+= (общая для всех строк).
+    // Меняйте её при старте программы, до создания рабочих потоков.
+    static GrowthPolicy growth_policy() { return growth_policy_slot(); }
+    static void set_growth_policy(const GrowthPolicy& policy) { growth_policy_slot() = policy; }
+
+    // operator[]: с проверкой границ (std::out_of_range), если IND3_CHECKED_INDEX,
+    // иначе только assert
+    char& operator[](size_t index) {
+        prepare_leak(); // через ссылку строку могут изменить
+#if IND3_CHECKED_INDEX
+        if (index >= length_) {
+            throw std::out_of_range("String::operator[]: index out of range");
+        }
+#else
+        assert(index < length_);
+#endif
+        return data_[index];
+    }
+    const char& operator[](size_t index) const {
+#if IND3_CHECKED_INDEX
+        if (index >= length_) {
+            throw std::out_of_range("String::operator[] const: index out of range");
+        }
+#else
+        assert(index < length_);
+#endif
+        return data_[index];
+    }
+
+    // Доступ с проверкой границ в любой сборке (бросает std::out_of_range)
+    char& at(size_t index) {
+        prepare_leak();
+        if (index >= length_) throw std::out_of_range("String::at: index out of range");
+        return data_[index];
+    }
+    const char& at(size_t index) const {
+        if (index >= length_) throw std::out_of_range("String::at const: index out of range");
+        return data_[index];
+    }
+
+    // Доступ без проверки — для внутренних циклов, где индекс заведомо верен
+    char& unchecked_at(size_t index) { prepare_leak(); return data_[index]; }
+    const char& unchecked_at(size_t index) const { return data_[index]; }
+
+    // Сырой буфер: length() символов и завершающий '\0'
+    char* data() { prepare_leak(); return data_; }
+    const char* data() const { return data_; }
+
+    // Итераторы — обычные указатели на символы
+    char* begin() { prepare_leak(); return data_; }
+    char* end() { prepare_leak(); return data_ + length_; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + length_; }
+
+    const char* c_str() const { return data_; }
+
+    // Ресурс, из которого берётся память под буфер
+    MemoryResource* get_resource() const { return res_; }
+
+    // Включить копирование при записи для этой строки (см. комментарий к классу).
+    // Режим сохраняется при перемещении и передаётся копиям.
+    void make_shareable() {
+        if (shared_) return;
+        if (!is_local()) {
+            char* buf = allocate_raw(capacity_, true); // может бросить
+            simd::copy_bytes(buf, data_, length_ + 1);
+            release_heap(data_, capacity_, false);
+            data_ = buf;
+        }
+        shared_ = true;
+    }
+
+    bool is_shareable() const { return shared_; }
+
+    // Сколько строк делят буфер (1 — буфер собственный)
+    size_t use_count() const {
+        return (shared_ && !is_local()) ? header_of(data_)->refs.load(std::memory_order_acquire) : 1;
+    }
+
+    // 64-битный хеш содержимого (см. hashing::hash_bytes).
+    // При IND3_CACHE_HASH считается один раз до следующего изменения строки.
+    uint64_t hash() const {
+#if defined(IND3_CACHE_HASH)
+        if (hash_ == 0) {
+            uint64_t h = hashing::hash_bytes(data_, length_);
+            hash_ = h ? h : 1; // 0 зарезервирован под "не посчитан"
+        }
+        return hash_;
+#else
+        return hashing::hash_bytes(data_, length_);
+#endif
+    }
+
+    // -------------------- swap и присваивания --------------------
+
+    friend void swap(String& a, String& b) noexcept {
+        if (!a.is_local() && !b.is_local()) {
+            using std::swap;
+            swap(a.data_, b.data_);
+            swap(a.length_, b.length_);
+            swap(a.capacity_, b.capacity_);
+            swap(a.res_, b.res_);
+            swap(a.shared_, b.shared_);
+#if defined(IND3_CACHE_HASH)
+            swap(a.hash_, b.hash_);
+#endif
+            return;
+        }
+        // Хотя бы одна строка во внутреннем буфере: указатели менять нельзя,
+        // меняемся через перемещения (они не выделяют память)
+        String tmp(std::move(a));
+        a = std::move(b);
+        b = std::move(tmp);
+    }
+
+    // copy-and-swap
+    String& operator=(const String& other) {
+        IND3_STAT(kCopyAssign, 1);
+        if (this != &other) {
+            String tmp(other); // может бросить
+            swap(*this, tmp);
+        }
+        return *this;
+    }
+
+    // move-assign: освобождаем свой буфер и забираем буфер other (noexcept)
+    String& operator=(String&& other) noexcept {
+        IND3_STAT(kMoveAssign, 1);
+        if (this != &other) {
+            release_buffer();
+            steal_from(other);
+        }
+        return *this;
+    }
+
+    // Присваивание из C-строки
+    String& operator=(const char* str) {
+        String tmp(str); // может бросить
+        swap(*this, tmp);
+        return *this;
+    }
+
+    // -------------------- Операции со строками --------------------
+
+    // Конкатенация: возвращает ленивое выражение this + other (см. StringConcat).
+    // Строка собирается одним выделением памяти при преобразовании в String.
+    StringConcat<String, String> operator+(const String& other) const;
+    template <class L, class R>
+    StringConcat<String, StringConcat<L, R>> operator+(const StringConcat<L, R>& other) const;
+
+    // Материализация цепочки a + b + ... : один reserve под итоговую длину,
+    // затем фрагменты копируются подряд. Память — из ресурса самого левого операнда.
+    template <class L, class R>
+    String(const StringConcat<L, R>& expr)
+        : data_(local_buf_), length_(0), res_(expr.get_resource())
+    {
+        IND3_STAT(kConcat, 1);
+        size_t newlen = expr.length();
+        reserve(newlen); // может бросить; короткий результат останется внутри
+        expr.write_to(data_);
+        IND3_STAT(kBytesCopied, newlen);
+        data_[newlen] = '\0';
+        length_ = newlen;
+    }
+
+    // this += other (other может быть самой строкой: s += s)
+    String& operator+=(const String& other) {
+        IND3_STAT(kAppend, 1);
+        append_bytes(other.data_, other.length_); // может бросить
+        return *this;
+    }
+
+    // this += C-строка
+    String& operator+=(const char* str) {
+        IND3_STAT(kAppend, 1);
+        if (!str) return *this;
+        append_bytes(str, simd::str_length(str)); // может бросить
+        return *this;
+    }
+
+    // this += view (view может смотреть на саму строку)
+    String& operator+=(StringView view) {
+        IND3_STAT(kAppend, 1);
+        append_bytes(view.data(), view.length()); // может бросить
+        return *this;
+    }
+
+    // Дописать len байт из ptr: длина известна, '\0' не ищется.
+    // ptr может указывать внутрь самой строки.
+    String& append(const char* ptr, size_t len) {
+        IND3_STAT(kAppend, 1);
+        append_bytes(ptr, len); // может бросить
+        return *this;
+    }
+
+    // Дописать n копий символа ch: одна проверка ёмкости на весь блок
+    String& append(size_t n, char ch) {
+        IND3_STAT(kAppend, 1);
+        grow_for(length_ + n); // может бросить
+        prepare_write();       // может бросить
+        char* dst = data_ + length_; // локальный указатель: запись char не перечитывает data_
+        for (size_t i = 0; i < n; ++i) dst[i] = ch;
+        length_ += n;
+        data_[length_] = '\0';
+        return *this;
+    }
+
+    // Дописать целое в десятичной записи: цифры пишутся сразу в буфер строки,
+    // без временной C-строки; выделение — не больше одного (по политике роста)
+    template <class Int>
+    typename std::enable_if<std::is_integral<Int>::value && !std::is_same<Int, bool>::value, String&>::type
+    append_int(Int v) {
+        uint64_t magnitude;
+        bool negative = number::split_sign(v, magnitude);
+        unsigned digits = number::count_digits(magnitude);
+        size_t len = length_;
+        IND3_STAT(kAppend, 1);
+        resize_and_overwrite(len + negative + digits, [=](char* buf, size_t n) {
+            if (negative) buf[len] = '-';
+            number::write_uint(buf + len + negative, magnitude, digits);
+            return n;
+        });
+        return *this;
+    }
+
+    // Дописать кратчайшую запись v, которая читается обратно в то же значение
+    // (std::to_chars, если доступен); разделитель — '.' при любой локали
+    String& append_double(double v) {
+        size_t len = length_;
+        IND3_STAT(kAppend, 1);
+        resize_and_overwrite(len + number::kMaxDoubleChars, [len, v](char* buf, size_t) {
+            return len + number::format_double(buf + len, v);
+        });
+        return *this;
+    }
+
+    // Изменить длину до n: новые символы заполняются ch,
+    // при укорочении ёмкость не меняется
+    void resize(size_t n, char ch = '\0') {
+        if (n > length_) {
+            append(n - length_, ch);
+            return;
+        }
+        prepare_write(); // может бросить
+        length_ = n;
+        data_[n] = '\0';
+    }
+
+    // Запись прямо в буфер (по образцу std::string::resize_and_overwrite из C++23).
+    // Ёмкость расширяется до n по политике роста, затем op(char* buf, size_t n)
+    // пишет в buf[0..n) без проверок и возвращает итоговую длину (не больше n).
+    // Первые min(length(), n) символов к моменту вызова сохранены, остальные
+    // не инициализированы. Если op бросает, длина становится min(length(), n),
+    // а в этих символах остаётся то, что op успел записать.
+    template <class Op>
+    void resize_and_overwrite(size_t n, Op op) {
+        grow_for(n);    // может бросить
+        prepare_write(); // может бросить
+        size_t new_len;
+        try {
+            new_len = static_cast<size_t>(op(data_, n));
+        }
+        catch (...) {
+            data_[length_ < n ? length_ : n] = '\0';
+            if (length_ > n) length_ = n; // хвост за n могли перезаписать
+            throw;
+        }
+        assert(new_len <= n);
+        length_ = new_len;
+        data_[new_len] = '\0';
+    }
+
+    // Очистить строку (сделать пустой)
+    void clear() {
+        if (buffer_is_shared()) { // общий буфер не копируем — просто отпускаем
+            release_buffer();
+            set_local_empty();
+            return;
+        }
+        invalidate_hash();
+        length_ = 0;
+        data_[0] = '\0';
+    }
+
+    // -------------------- Сравнения --------------------
+
+    bool operator==(const String& other) const {
+        IND3_STAT(kEqual, 1);
+        if (length_ != other.length_) return false; // сначала дешёвая проверка длины
+#if defined(IND3_CACHE_HASH)
+        if (hash_ && other.hash_ && hash_ != other.hash_) return false;
+#endif
+        return simd::first_mismatch(data_, other.data_, length_) == length_;
+    }
+
+    bool operator==(StringView other) const { return StringView(data_, length_) == other; }
+    bool operator==(const char* other) const { return *this == StringView(other); }
+
+    bool operator!=(const String& other) const { return !(*this == other); }
+    bool operator!=(StringView other) const { return !(*this == other); }
+    bool operator!=(const char* other) const { return !(*this == other); }
+    bool operator<(const String& other) const { return compare_lex(other) < 0; }
+    bool operator>(const String& other) const { return compare_lex(other) > 0; }
+    bool operator<(StringView other) const { return compare_lex(other) < 0; }
+    bool operator>(StringView other) const { return compare_lex(other) > 0; }
+    bool operator<(const char* other) const { return compare_lex(StringView(other)) < 0; }
+    bool operator>(const char* other) const { return compare_lex(StringView(other)) > 0; }
+
+    // Лексикографическое сравнение: <0, 0, >0
+    int compare(StringView other) const { return compare_lex(other); }
+
+    // -------------------- Поиск и подстроки (без выделений) --------------------
+
+    // Взгляд на всю строку; действителен до изменения или удаления строки
+    StringView view() const { return StringView(data_, length_); }
+
+    StringView substr(size_t pos, size_t count = StringView::npos) const { return view().substr(pos, count); }
+    size_t find(char ch, size_t pos = 0) const { return view().find(ch, pos); }
+    size_t find(StringView needle, size_t pos = 0) const { return view().find(needle, pos); }
+    size_t rfind(char ch, size_t pos = StringView::npos) const { return view().rfind(ch, pos); }
+    size_t rfind(StringView needle, size_t pos = StringView::npos) const { return view().rfind(needle, pos); }
+    bool starts_with(StringView prefix) const { return view().starts_with(prefix); }
+    bool ends_with(StringView suffix) const { return view().ends_with(suffix); }
+    bool contains(char ch) const { return view().contains(ch); }
+    bool contains(StringView needle) const { return view().contains(needle); }
+    size_t count(StringView needle) const { return view().count(needle); }
+    std::vector<size_t> find_all(StringView needle) const { return view().find_all(needle); }
+    SplitRange split(char delim) const { return view().split(delim); }
+
+    // -------------------- Регистр и классы символов (ASCII) --------------------
+    // Байты вне ASCII (в том числе многобайтовые символы UTF-8) не меняются
+
+    int compare_icase(StringView other) const {
+        IND3_STAT(kCompare, 1);
+        return view().compare_icase(other);
+    }
+    bool equals_icase(StringView other) const { return view().equals_icase(other); }
+    size_t count_if(CharClass cls) const { return view().count_if(cls); }
+    bool all_of(CharClass cls) const { return view().all_of(cls); }
+
+    // Числа читаются прямо из буфера строки, см. StringView::parse_int
+    template <class Int>
+    size_t parse_int(Int& out) const { return view().parse_int(out); }
+    size_t parse_double(double& out) const { return view().parse_double(out); }
+
+    bool is_valid_utf8() const { return view().is_valid_utf8(); }
+    bool is_ascii() const { return view().is_ascii(); }
+    size_t code_point_count() const { return view().code_point_count(); }
+    CodePointRange code_points() const { return view().code_points(); }
+
+    // Дописать кодовую точку в UTF-8 (см. utf8::encode)
+    String& append_code_point(char32_t cp) {
+        char buf[4];
+        return append(buf, utf8::encode(cp, buf));
+    }
+
+    // Перевод в нижний / верхний регистр на месте
+    String& to_lower() {
+        prepare_write(); // может бросить
+        simd::to_lower(data_, data_, length_);
+        return *this;
+    }
+    String& to_upper() {
+        prepare_write(); // может бросить
+        simd::to_upper(data_, data_, length_);
+        return *this;
+    }
+
+    // Копии в нижнем / верхнем регистре: один проход из этой строки сразу
+    // в буфер результата, без промежуточного копирования
+    String lower_copy() const { return case_copy(&simd::to_lower); }
+    String upper_copy() const { return case_copy(&simd::to_upper); }
+
+    // -------------------- Дополнительные методы --------------------
+
+    // Содержимое файла без копирования (см. MappedFile); определён после MappedFile
+    static MappedFile map_file(const char* path, MemoryResource* res = MemoryResource::default_resource());
+
+    // Ёмкость до kLocalCapacity обеспечивается внутренним буфером без выделений
+    void reserve(size_t new_cap) {
+        if (new_cap <= capacity()) return;
+        char* buf = allocate_buffer(new_cap); // может бросить
+        simd::copy_bytes(buf, data_, length_);
+        buf[length_] = '\0';
+        if (!is_local()) IND3_STAT(kReallocations, 1);
+        IND3_STAT(kBytesCopied, length_);
+        release_buffer();
+        data_ = buf;
+        capacity_ = new_cap; // затирает local_buf_, но он уже скопирован
+    }
+
+    void push_back(char ch) {
+        IND3_STAT(kPushBack, 1);
+        grow_for(length_ + 1); // может бросить
+        prepare_write();       // может бросить
+        data_[length_++] = ch;
+        data_[length_] = '\0';
+    }
+
+    // Уменьшить ёмкость до длины строки. Короткая строка возвращается
+    // во внутренний буфер, и память в куче освобождается полностью.
+    void shrink_to_fit() {
+        if (is_local() || capacity_ == length_) return;
+        if (length_ <= kLocalCapacity) {
+            char* old = data_;
+            size_t old_cap = capacity_; // capacity_ делит память с local_buf_
+            simd::copy_bytes(local_buf_, old, length_ + 1);
+            IND3_STAT(kBytesCopied, length_);
+            data_ = local_buf_;
+            release_heap(old, old_cap, shared_);
+            return;
+        }
+        char* buf = allocate_buffer(length_); // может бросить
+        simd::copy_bytes(buf, data_, length_ + 1);
+        IND3_STAT(kBytesCopied, length_);
+        release_buffer();
+        data_ = buf;
+        capacity_ = length_;
+    }
+
+    // -------------------- Новая функция: символы, не являющиеся общими --------------------
+    // Формирует строку, содержащую все вхождения символов из *this и other,
+    // которые НЕ встречаются в другой строке.
+    // range = Ascii: учитываются только 0..127 (остальные байты отбрасываются);
+    // range = AllBytes: учитываются все 256 значений байта.
+    // Порядок и количество вхождений сохраняются.
+    String unique_chars_with(const String& other, CharRange range = CharRange::Ascii) const {
+        String result(res_);
+        unique_chars_with(other, result, range);
+        return result;
+    }
+
+    // То же, но результат записывается в out (его буфер переиспользуется,
+    // если ёмкости хватает). out может совпадать с *this или other.
+    void unique_chars_with(const String& other, String& out, CharRange range = CharRange::Ascii) const {
+        if (&out == this || &out == &other) {
+            String tmp(out.res_);
+            unique_chars_with(other, tmp, range);
+            out = std::move(tmp);
+            return;
+        }
+
+        // Гистограммы байтов: из них получаем и множества присутствия,
+        // и точный размер результата без отдельного прохода по строкам
+        size_t hist_this[256];
+        size_t hist_other[256];
+        byte_histogram(data_, length_, hist_this);
+        byte_histogram(other.data_, other.length_, hist_other);
+        unique_from_histograms(*this, hist_this, other, hist_other, range, out);
+    }
+
+    // -------------------- unique_chars_with по кодовым точкам --------------------
+    // То же, что unique_chars_with, но единица — кодовая точка UTF-8, а не байт:
+    // кириллица и другие многобайтовые символы сохраняются целиком.
+    // Некорректные байты считаются символом U+FFFD и так и выводятся, поэтому
+    // результат — всегда корректный UTF-8. Для двух ASCII-строк результат
+    // совпадает с unique_chars_with и считается им же.
+    String unique_code_points_with(const String& other) const {
+        String result(res_);
+        unique_code_points_with(other, result);
+        return result;
+    }
+
+    void unique_code_points_with(const String& other, String& out) const {
+        if (&out == this || &out == &other) {
+            String tmp(out.res_);
+            unique_code_points_with(other, tmp);
+            out = std::move(tmp);
+            return;
+        }
+        if (is_ascii() && other.is_ascii()) {
+            unique_chars_with(other, out, CharRange::Ascii);
+            return;
+        }
+        CodePointSet in_this, in_other;
+        in_this.insert_text(data_, length_);
+        in_other.insert_text(other.data_, other.length_);
+
+        size_t count = filter_code_points(data_, length_, in_other, nullptr) +
+                       filter_code_points(other.data_, other.length_, in_this, nullptr);
+        out.clear();
+        out.reserve(count); // может бросить; буфер точно по размеру результата
+        size_t pos = filter_code_points(data_, length_, in_other, out.data_);
+        pos += filter_code_points(other.data_, other.length_, in_this, out.data_ + pos);
+        out.data_[pos] = '\0';
+        out.length_ = pos;
+    }
+
+private:
+    friend class CharSetProfile;
+    friend class UniqueCharsStream;
+
+    // Записать в dst кодовые точки src, которых нет в exclude, и вернуть число
+    // записанных байт; dst == nullptr — только посчитать их
+    static size_t filter_code_points(const char* src, size_t n, const CodePointSet& exclude, char* dst) {
+        size_t pos = 0;
+        for (size_t i = 0; i < n;) {
+            size_t len;
+            char32_t cp = utf8::decode(src + i, n - i, len);
+            if (!exclude.contains(cp)) {
+                bool invalid = (cp == utf8::kReplacement && len == 1);
+                if (invalid) {
+                    if (dst) utf8::encode(utf8::kReplacement, dst + pos);
+                    pos += 3;
+                }
+                else {
+                    if (dst) for (size_t k = 0; k < len; ++k) dst[pos + k] = src[i + k];
+                    pos += len;
+                }
+            }
+            i += len;
+        }
+        return pos;
+    }
+
+    // Общая часть unique_chars_with, когда гистограммы обеих строк уже есть.
+    // out не должен совпадать с a или b.
+    static void unique_from_histograms(const String& a, const size_t hist_this[256],
+                                       const String& b, const size_t hist_other[256],
+                                       CharRange range, String& out) {
+        ByteSet in_this = ByteSet::from_histogram(hist_this);
+        ByteSet in_other = ByteSet::from_histogram(hist_other);
+        ByteSet allowed = (range == CharRange::Ascii) ? ByteSet::ascii() : ByteSet::all();
+
+        // Символы this, которых нет в other, и наоборот
+        ByteSet keep_this = allowed & ~in_other;
+        ByteSet keep_other = allowed & ~in_this;
+
+        size_t count = 0;
+        for (size_t c = 0; c < 256; ++c) {
+            if (keep_this.contains(static_cast<unsigned char>(c))) count += hist_this[c];
+            if (keep_other.contains(static_cast<unsigned char>(c))) count += hist_other[c];
+        }
+
+        out.clear();
+        out.reserve(count); // может бросить; буфер точно по размеру результата
+        size_t pos = filter_bytes(a.data_, a.length_, keep_this, out.data_);
+        pos += filter_bytes(b.data_, b.length_, keep_other, out.data_ + pos);
+        out.data_[pos] = '\0';
+        out.length_ = pos;
+    }
+
+    // Подсчитать количество вхождений каждого байта
+    static void byte_histogram(const char* s, size_t n, size_t hist[256]) {
+        for (size_t c = 0; c < 256; ++c) hist[c] = 0;
+        for (size_t i = 0; i < n; ++i) ++hist[static_cast<unsigned char>(s[i])];
+    }
+
+    // Скопировать в dst байты из src, входящие в keep; возвращает их число.
+    // Без ветвлений: байт пишется всегда, а позиция сдвигается только для
+    // подходящих. Поэтому в dst нужен 1 запасной байт (место под '\0').
+    static size_t filter_bytes(const char* src, size_t n, const ByteSet& keep, char* dst) {
+        size_t pos = 0;
+        for (size_t i = 0; i < n; ++i) {
+            dst[pos] = src[i];
+            pos += keep.contains(static_cast<unsigned char>(src[i])) ? 1 : 0;
+        }
+        return pos;
+    }
+};
+
+// -------------------- Профиль для многократного unique_chars_with --------------------
+// Когда одна и та же строка сравнивается с тысячами кандидатов, её гистограмма
+// строится один раз здесь, а не при каждом вызове. Профиль хранит копию строки,
+// поэтому исходную строку после построения можно менять или удалять.
+class CharSetProfile {
+public:
+    explicit CharSetProfile(const String& reference, CharRange range = CharRange::Ascii)
+        : text_(reference), range_(range)
+    {
+        String::byte_histogram(text_.data_, text_.length_, hist_);
+    }
+
+    const String& reference() const { return text_; }
+
+    // Эквивалент reference().unique_chars_with(candidate, range)
+    String unique_chars_with(const String& candidate) const {
+        String result(text_.get_resource());
+        unique_chars_with(candidate, result);
+        return result;
+    }
+
+    // Результат записывается в out; out может совпадать с candidate
+    void unique_chars_with(const String& candidate, String& out) const {
+        if (&out == &candidate) {
+            String tmp(out.get_resource());
+            unique_chars_with(candidate, tmp);
+            out = std::move(tmp);
+            return;
+        }
+        size_t hist_other[256];
+        String::byte_histogram(candidate.data_, candidate.length_, hist_other);
+        String::unique_from_histograms(text_, hist_, candidate, hist_other, range_, out);
+    }
+
+    // Пакетная обработка: out[i] = reference().unique_chars_with(candidates[i]).
+    // out — заранее созданный массив из count строк (их буферы переиспользуются).
+    // threads > 1 делит кандидатов на равные части между потоками,
+    // threads == 0 — по числу аппаратных потоков. Исключение из любого
+    // потока пробрасывается вызывающему после завершения всех потоков.
+    void unique_chars_batch(const String* candidates, size_t count, String* out,
+                            unsigned threads = 1) const {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads > count) threads = static_cast<unsigned>(count);
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; ++i) unique_chars_with(candidates[i], out[i]);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        std::vector<std::exception_ptr> errors(threads);
+        size_t per_thread = (count + threads - 1) / threads;
+        for (unsigned t = 0; t < threads; ++t) {
+            size_t begin = t * per_thread;
+            size_t end = (begin + per_thread < count) ? begin + per_thread : count;
+            workers.push_back(std::thread([this, candidates, out, begin, end, t, &errors] {
+                try {
+                    for (size_t i = begin; i < end; ++i) unique_chars_with(candidates[i], out[i]);
+                }
+                catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+        for (size_t t = 0; t < errors.size(); ++t)
+            if (errors[t]) std::rethrow_exception(errors[t]);
+    }
+
+private:
+    String text_;      // копия исходной строки
+    size_t hist_[256]; // её гистограмма байтов
+    CharRange range_;
+};
+
+// -------------------- Потоковый unique_chars_with --------------------
+// unique_chars_with для входов, которые не помещаются в память целиком.
+// Проход 1: scan_first/scan_second по кускам строят гистограммы обоих входов.
+// Проход 2: filter_first/filter_second по тем же данным (в том же порядке
+// кусков) отфильтровывают каждый кусок и передают результат в
+// sink(StringView). Выходы filter_first по всему первому входу, а затем
+// filter_second по второму вместе дают ровно a.unique_chars_with(b, range).
+// Память — один буфер размером с наибольший кусок, независимо от длины входа.
+class UniqueCharsStream {
+public:
+    explicit UniqueCharsStream(CharRange range = CharRange::Ascii,
+                               MemoryResource* res = MemoryResource::default_resource())
+        : range_(range), filtering_(false), buf_(res) {
+        reset();
+    }
+
+    // Начать заново (ёмкость буфера сохраняется)
+    void reset() {
+        for (size_t c = 0; c < 256; ++c) hist_first_[c] = hist_second_[c] = 0;
+        filtering_ = false;
+    }
+
+    // -------- проход 1 --------
+    void scan_first(StringView chunk) { scan(chunk, hist_first_); }
+    void scan_second(StringView chunk) { scan(chunk, hist_second_); }
+
+    // Точная длина результата; известна после первого прохода
+    uint64_t result_length() {
+        start_filtering();
+        uint64_t count = 0;
+        for (size_t c = 0; c < 256; ++c) {
+            if (keep_first_.contains(static_cast<unsigned char>(c))) count += hist_first_[c];
+            if (keep_second_.contains(static_cast<unsigned char>(c))) count += hist_second_[c];
+        }
+        return count;
+    }
+
+    // -------- проход 2 --------
+    // sink вызывается только для непустых результатов; переданный взгляд
+    // действителен до следующего вызова filter_*
+    template <class Sink>
+    void filter_first(StringView chunk, Sink sink) { filter(chunk, keep_first_, sink); }
+
+    template <class Sink>
+    void filter_second(StringView chunk, Sink sink) { filter(chunk, keep_second_, sink); }
+
+private:
+    void scan(StringView chunk, uint64_t hist[256]) {
+        if (filtering_) throw std::logic_error("UniqueCharsStream: scan after filtering started");
+        for (size_t i = 0; i < chunk.length(); ++i) ++hist[static_cast<unsigned char>(chunk[i])];
+    }
+
+    // Первый проход закончен: те же наборы, что в String::unique_from_histograms
+    void start_filtering() {
+        if (filtering_) return;
+        ByteSet in_first, in_second;
+        for (size_t c = 0; c < 256; ++c) {
+            if (hist_first_[c]) in_first.insert(static_cast<unsigned char>(c));
+            if (hist_second_[c]) in_second.insert(static_cast<unsigned char>(c));
+        }
+        ByteSet allowed = (range_ == CharRange::Ascii) ? ByteSet::ascii() : ByteSet::all();
+        keep_first_ = allowed & ~in_second;
+        keep_second_ = allowed & ~in_first;
+        filtering_ = true;
+    }
+
+    template <class Sink>
+    void filter(StringView chunk, const ByteSet& keep, Sink& sink) {
+        start_filtering();
+        buf_.resize_and_overwrite(chunk.length(), [&chunk, &keep](char* dst, size_t) {
+            return String::filter_bytes(chunk.data(), chunk.length(), keep, dst);
+        });
+        if (!buf_.empty()) sink(buf_.view());
+    }
+
+    CharRange range_;
+    bool filtering_;          // начался второй проход
+    uint64_t hist_first_[256]; // uint64_t: входы могут быть больше 4 ГБ и на 32-битных сборках
+    uint64_t hist_second_[256];
+    ByteSet keep_first_;
+    ByteSet keep_second_;
+    String buf_;              // результат текущего куска
+};
+
+// -------------------- Поиск множества образцов (Ахо–Корасик) --------------------
+// Все вхождения сотен образцов за один проход по тексту. Автомат строится один
+// раз: переходы по всем байтам уже достроены (полный ДКА, без прыжков по
+// суффиксным ссылкам при поиске). Байты, не встречающиеся в образцах, сведены
+// в общий класс, поэтому таблица переходов плотная: состояния x классы.
+
+// Найденное вхождение: номер образца (в порядке конструктора) и позиция начала
+struct PatternMatch {
+    size_t pattern;
+    size_t position;
+};
+
+class MultiPatternMatcher {
+public:
+    // Пустые образцы пропускаются (они не дают вхождений)
+    explicit MultiPatternMatcher(const std::vector<String>& patterns)
+        : class_count_(1), state_count_(1)
+    {
+        for (size_t c = 0; c < 256; ++c) class_of_[c] = 0;
+        for (size_t p = 0; p < patterns.size(); ++p) {
+            for (unsigned char c : patterns[p]) {
+                if (class_of_[c] == 0) class_of_[c] = static_cast<uint16_t>(class_count_++);
+            }
+            lengths_.push_back(patterns[p].length());
+        }
+
+        // Бор: delta_ хранит переходы, kNone — перехода пока нет
+        delta_.assign(class_count_, kNone);
+        std::vector<std::vector<uint32_t>> own(1); // образцы, оканчивающиеся в состоянии
+        for (size_t p = 0; p < patterns.size(); ++p) {
+            if (patterns[p].empty()) continue;
+            uint32_t s = 0;
+            for (unsigned char c : patterns[p]) {
+                uint32_t& next = delta_[s * class_count_ + class_of_[c]];
+                if (next == kNone) {
+                    next = static_cast<uint32_t>(state_count_++);
+                    delta_.resize(state_count_ * class_count_, kNone); // next может стать недействительной
+                    own.push_back(std::vector<uint32_t>());
+                }
+                s = delta_[s * class_count_ + class_of_[c]];
+            }
+            own[s].push_back(static_cast<uint32_t>(p));
+        }
+
+        // Обход в ширину: суффиксные ссылки, достройка переходов и списки выходов.
+        // Состояние обрабатывается после своей суффиксной ссылки (она мельче),
+        // поэтому её выходы к этому моменту уже собраны.
+        std::vector<uint32_t> fail(state_count_, 0);
+        std::vector<uint32_t> order;
+        order.reserve(state_count_);
+        order.push_back(0);
+        out_begin_.assign(state_count_ + 1, 0);
+        std::vector<std::vector<uint32_t>> outputs(state_count_);
+        for (size_t head = 0; head < order.size(); ++head) {
+            uint32_t s = order[head];
+            outputs[s] = own[s];
+            if (s != 0) {
+                const std::vector<uint32_t>& inherited = outputs[fail[s]];
+                outputs[s].insert(outputs[s].end(), inherited.begin(), inherited.end());
+            }
+            for (size_t c = 0; c < class_count_; ++c) {
+                uint32_t& t = delta_[s * class_count_ + c];
+                uint32_t via_fail = (s == 0) ? 0 : delta_[fail[s] * class_count_ + c];
+                if (t == kNone) {
+                    t = via_fail; // перехода в боре нет — идём как из суффиксной ссылки
+                }
+                else {
+                    fail[t] = via_fail;
+                    order.push_back(t);
+                }
+            }
+        }
+
+        // Выходы всех состояний — подряд в одном массиве
+        for (size_t s = 0; s < state_count_; ++s) {
+            out_begin_[s] = static_cast<uint32_t>(outs_.size());
+            outs_.insert(outs_.end(), outputs[s].begin(), outputs[s].end());
+        }
+        out_begin_[state_count_] = static_cast<uint32_t>(outs_.size());
+    }
+
+    size_t pattern_count() const { return lengths_.size(); }
+    size_t state_count() const { return state_count_; }
+
+    // Вызвать on_match(PatternMatch) для каждого вхождения, в порядке их концов
+    template <class F>
+    void scan(StringView text, F on_match) const {
+        uint32_t state = 0;
+        run(text, state, 0, on_match);
+    }
+
+    std::vector<PatternMatch> find_all(StringView text) const {
+        std::vector<PatternMatch> matches;
+        scan(text, [&](const PatternMatch& m) { matches.push_back(m); });
+        return matches;
+    }
+
+    size_t count(StringView text) const {
+        size_t n = 0;
+        scan(text, [&](const PatternMatch&) { ++n; });
+        return n;
+    }
+
+    // Потоковый режим: текст подаётся кусками, состояние автомата сохраняется
+    // между ними, поэтому находятся и вхождения на стыке кусков.
+    // Позиции отсчитываются от начала всего потока.
+    class Stream {
+    public:
+        explicit Stream(const MultiPatternMatcher& matcher) : matcher_(&matcher), state_(0), offset_(0) {}
+
+        template <class F>
+        void feed(StringView chunk, F on_match) {
+            matcher_->run(chunk, state_, offset_, on_match);
+            offset_ += chunk.length();
+        }
+
+        size_t offset() const { return offset_; }
+        void reset() { state_ = 0; offset_ = 0; }
+
+    private:
+        const MultiPatternMatcher* matcher_;
+        uint32_t state_;
+        size_t offset_; // сколько байт уже подано
+    };
+
+    Stream stream() const { return Stream(*this); }
+
+private:
+    static const uint32_t kNone = 0xFFFFFFFFu;
+
+    template <class F>
+    void run(StringView text, uint32_t& state, size_t offset, F& on_match) const {
+        const uint32_t* delta = delta_.data();
+        for (size_t i = 0; i < text.length(); ++i) {
+            state = delta[state * class_count_ + class_of_[static_cast<unsigned char>(text[i])]];
+            for (uint32_t k = out_begin_[state]; k < out_begin_[state + 1]; ++k) {
+                uint32_t p = outs_[k];
+                PatternMatch m = { p, offset + i + 1 - lengths_[p] };
+                on_match(m);
+            }
+        }
+    }
+
+    uint16_t class_of_[256];           // класс каждого байта (0 — нет ни в одном образце)
+    size_t class_count_;
+    size_t state_count_;
+    std::vector<uint32_t> delta_;      // переходы: state * class_count_ + class
+    std::vector<uint32_t> out_begin_;  // выходы состояния s: outs_[out_begin_[s], out_begin_[s + 1])
+    std::vector<uint32_t> outs_;
+    std::vector<size_t> lengths_;      // длины образцов
+};
+
+const uint32_t MultiPatternMatcher::kNone;
+
+// -------------------- Ленивая конкатенация --------------------
+// Как хранится операнд в StringConcat: строки — по ссылке,
+// вложенные выражения — по значению (это всего пара ссылок).
+template <class T> struct ConcatOperand { typedef const T& type; };
+template <class L, class R> struct ConcatOperand<StringConcat<L, R>> { typedef StringConcat<L, R> type; };
+
+// Выражение "L + R", которое возвращает operator+. Само ничего не выделяет,
+// только запоминает операнды; строка строится целиком при преобразовании
+// в String, поэтому a + b + c + d — это одно выделение вместо трёх.
+// Выражение ссылается на исходные строки (и на временные объекты выражения),
+// поэтому его нельзя сохранять в auto — сразу присваивайте в String.
+template <class L, class R>
+class StringConcat {
+public:
+    StringConcat(const L& l, const R& r) : l_(l), r_(r) {}
+
+    size_t length() const { return l_.length() + r_.length(); }
+
+    // Записать все фрагменты подряд в dst; возвращает позицию за последним символом
+    char* write_to(char* dst) const { return write_piece(r_, write_piece(l_, dst)); }
+
+    // Ресурс памяти самого левого операнда
+    MemoryResource* get_resource() const { return resource_of(l_); }
+
+    StringConcat<StringConcat, String> operator+(const String& other) const {
+        return StringConcat<StringConcat, String>(*this, other);
+    }
+    template <class L2, class R2>
+    StringConcat<StringConcat, StringConcat<L2, R2>> operator+(const StringConcat<L2, R2>& other) const {
+        return StringConcat<StringConcat, StringConcat<L2, R2>>(*this, other);
+    }
+
+private:
+    static char* write_piece(const String& s, char* dst) {
+        simd::copy_bytes(dst, s.c_str(), s.length());
+        return dst + s.length();
+    }
+    template <class L2, class R2>
+    static char* write_piece(const StringConcat<L2, R2>& e, char* dst) { return e.write_to(dst); }
+
+    static MemoryResource* resource_of(const String& s) { return s.get_resource(); }
+    template <class L2, class R2>
+    static MemoryResource* resource_of(const StringConcat<L2, R2>& e) { return e.get_resource(); }
+
+    typename ConcatOperand<L>::type l_;
+    typename ConcatOperand<R>::type r_;
+};
+
+inline StringConcat<String, String> String::operator+(const String& other) const {
+    return StringConcat<String, String>(*this, other);
+}
+
+template <class L, class R>
+StringConcat<String, StringConcat<L, R>> String::operator+(const StringConcat<L, R>& other) const {
+    return StringConcat<String, StringConcat<L, R>>(*this, other);
+}
+
+const size_t String::kLocalCapacity;
+const size_t String::kSharedHeaderSize;
+
+inline StringView::StringView(const String& s) : data_(s.c_str()), length_(s.length()) {}
+
+// Хеш для std::unordered_map<String, ...> и подобных контейнеров
+namespace std {
+template <>
+struct hash<String> {
+    size_t operator()(const String& s) const noexcept { return static_cast<size_t>(s.hash()); }
+};
+} // namespace std
+
+// -------------------- Интернирование строк --------------------
+// Дескриптор строки из StringPool. Дескрипторы одного пула равны тогда и только
+// тогда, когда совпадают указатели; хеш посчитан при вставке и хранится рядом
+// с данными. Действителен, пока жив пул. Пустой дескриптор (по умолчанию)
+// обозначает пустую строку и не принадлежит никакому пулу.
+class InternedString {
+public:
+    InternedString() noexcept : entry_(nullptr) {}
+
+    StringView view() const noexcept {
+        return entry_ ? StringView(entry_->data, entry_->length) : StringView();
+    }
+    const char* c_str() const noexcept { return entry_ ? entry_->data : ""; }
+    size_t length() const noexcept { return entry_ ? entry_->length : 0; }
+    bool empty() const noexcept { return entry_ == nullptr; }
+
+    // Совпадает с String::hash() для того же содержимого
+    uint64_t hash() const noexcept { return entry_ ? entry_->hash : hashing::hash_bytes("", 0); }
+
+    // O(1): сравнение указателей (только для дескрипторов одного пула)
+    bool operator==(InternedString other) const noexcept { return entry_ == other.entry_; }
+    bool operator!=(InternedString other) const noexcept { return entry_ != other.entry_; }
+
+private:
+    friend class StringPool;
+
+    struct Entry {
+        uint64_t hash;
+        size_t length;
+        const char* data; // length + 1 байт сразу за Entry
+    };
+
+    explicit InternedString(const Entry* e) noexcept : entry_(e) {}
+
+    const Entry* entry_;
+};
+
+// Потокобезопасный пул интернированных строк. Значения раскладываются по
+// шардам по младшим битам хеша; каждый шард — открытая адресация с линейным
+// пробированием. Чтение (поиск уже интернированной строки) идёт без блокировок:
+// слот заполняется один раз, а таблица при росте строится заново и публикуется
+// атомарно. Вставка берёт мьютекс своего шарда. Старые таблицы не
+// освобождаются до разрушения пула, т.к. их ещё могут читать другие потоки
+// (суммарно это меньше размера текущей таблицы).
+class StringPool {
+public:
+    explicit StringPool(MemoryResource* upstream = MemoryResource::default_resource()) {
+        size_t made = 0;
+        try {
+            for (; made < kShardCount; ++made) shards_[made] = new Shard(upstream);
+        }
+        catch (...) {
+            while (made) destroy_shard(shards_[--made]);
+            throw;
+        }
+    }
+
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    ~StringPool() {
+        for (size_t i = 0; i < kShardCount; ++i) destroy_shard(shards_[i]);
+    }
+
+    // Вернуть дескриптор строки, добавив её в пул при первом обращении
+    InternedString intern(StringView s) {
+        if (s.empty()) return InternedString();
+        uint64_t h = hashing::hash_bytes(s.data(), s.length());
+        Shard& shard = *shards_[h & (kShardCount - 1)];
+
+        // Быстрый путь без блокировки: строка уже в пуле
+        if (const Entry* e = probe(shard.table.load(std::memory_order_acquire), h, s))
+            return InternedString(e);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Table* t = shard.table.load(std::memory_order_relaxed);
+        if (const Entry* e = probe(t, h, s)) return InternedString(e); // вставили, пока ждали
+        if ((shard.count + 1) * 2 > t->mask + 1) t = grow(shard, t);   // заполнение не выше 1/2
+
+        Entry* e = make_entry(shard, h, s);
+        insert_slot(t, e, std::memory_order_release);
+        ++shard.count;
+        return InternedString(e);
+    }
+
+    // Найти строку без вставки; пустой дескриптор, если её нет в пуле
+    InternedString find(StringView s) const {
+        if (s.empty()) return InternedString();
+        uint64_t h = hashing::hash_bytes(s.data(), s.length());
+        const Shard& shard = *shards_[h & (kShardCount - 1)];
+        return InternedString(probe(shard.table.load(std::memory_order_acquire), h, s));
+    }
+
+    // Число различных строк в пуле
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < kShardCount; ++i) {
+            std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+            total += shards_[i]->count;
+        }
+        return total;
+    }
+
+private:
+    typedef InternedString::Entry Entry;
+
+    static const size_t kShardCount = 16;  // степень двойки
+    static const size_t kShardBits = 4;    // log2(kShardCount)
+    static const size_t kInitialSlots = 64;
+
+    struct Table {
+        size_t mask;                       // число слотов - 1
+        std::atomic<const Entry*>* slots;
+        Table* retired;                    // предыдущая таблица шарда
+    };
+
+    struct Shard {
+        explicit Shard(MemoryResource* upstream) : count(0), arena(4096, upstream) {
+            table.store(make_table(kInitialSlots, nullptr), std::memory_order_relaxed);
+        }
+
+        std::atomic<Table*> table;
+        mutable std::mutex mutex;   // защищает вставку, count и arena
+        size_t count;
+        ArenaResource arena;        // записи Entry вместе с символами
+    };
+
+    static Table* make_table(size_t slots, Table* retired) {
+        Table* t = new Table;
+        try {
+            t->slots = new std::atomic<const Entry*>[slots];
+        }
+        catch (...) {
+            delete t;
+            throw;
+        }
+        for (size_t i = 0; i < slots; ++i) t->slots[i].store(nullptr, std::memory_order_relaxed);
+        t->mask = slots - 1;
+        t->retired = retired;
+        return t;
+    }
+
+    static void destroy_shard(Shard* shard) noexcept {
+        Table* t = shard->table.load(std::memory_order_relaxed);
+        while (t) {
+            Table* next = t->retired;
+            delete[] t->slots;
+            delete t;
+            t = next;
+        }
+        delete shard;
+    }
+
+    // Младшие биты хеша уже выбрали шард, для слота берём следующие
+    static size_t slot_of(uint64_t h, size_t mask) { return static_cast<size_t>(h >> kShardBits) & mask; }
+
+    static const Entry* probe(const Table* t, uint64_t h, StringView s) {
+        for (size_t i = slot_of(h, t->mask);; i = (i + 1) & t->mask) {
+            const Entry* e = t->slots[i].load(std::memory_order_acquire);
+            if (!e) return nullptr;
+            if (e->hash == h && e->length == s.length() &&
+                simd::first_mismatch(e->data, s.data(), s.length()) == s.length())
+                return e;
+        }
+    }
+
+    static void insert_slot(Table* t, const Entry* e, std::memory_order order) {
+        size_t i = slot_of(e->hash, t->mask);
+        while (t->slots[i].load(std::memory_order_relaxed)) i = (i + 1) & t->mask;
+        t->slots[i].store(e, order);
+    }
+
+    // Построить таблицу вдвое больше и опубликовать её; вызывается под мьютексом
+    static Table* grow(Shard& shard, Table* old) {
+        Table* t = make_table((old->mask + 1) * 2, old);
+        for (size_t i = 0; i <= old->mask; ++i) {
+            const Entry* e = old->slots[i].load(std::memory_order_relaxed);
+            if (e) insert_slot(t, e, std::memory_order_relaxed);
+        }
+        shard.table.store(t, std::memory_order_release); // публикуем уже заполненную таблицу
+        return t;
+    }
+
+    static Entry* make_entry(Shard& shard, uint64_t h, StringView s) {
+        size_t header = align_up(sizeof(Entry), alignof(Entry));
+        char* raw = static_cast<char*>(shard.arena.allocate(header + s.length() + 1));
+        char* chars = raw + header;
+        simd::copy_bytes(chars, s.data(), s.length());
+        chars[s.length()] = '\0';
+        Entry* e = reinterpret_cast<Entry*>(raw);
+        e->hash = h;
+        e->length = s.length();
+        e->data = chars;
+        return e;
+    }
+
+    Shard* shards_[kShardCount];
+};
+
+namespace std {
+template <>
+struct hash<InternedString> {
+    size_t operator()(InternedString s) const noexcept { return static_cast<size_t>(s.hash()); }
+};
+} // namespace std
+
+// -------------------- Параллельная сборка строки --------------------
+// Сборщик строки, в который одновременно пишут несколько потоков. Каждый
+// поток дописывает в свой список блоков (растущих от 256 байт до 64 КБ), так
+// что на горячем пути нет ни блокировок, ни перевыделений с копированием;
+// мьютекс берётся только при первом обращении потока к сборщику. finish()
+// склеивает всё в одну String одним выделением точного размера: сначала
+// вклад первого обратившегося потока, затем следующего и т.д., внутри потока
+// порядок дописывания сохраняется. finish() и деструктор нельзя вызывать,
+// пока другие потоки продолжают писать. Ресурс памяти должен быть
+// потокобезопасным (например, ресурс по умолчанию).
+class StringBuilder {
+public:
+    explicit StringBuilder(MemoryResource* res = MemoryResource::default_resource())
+        : res_(res), id_(next_id()) {}
+
+    StringBuilder(const StringBuilder&) = delete;
+    StringBuilder& operator=(const StringBuilder&) = delete;
+
+    ~StringBuilder() {
+        for (size_t i = 0; i < locals_.size(); ++i) {
+            release_chunks(locals_[i]);
+            delete locals_[i];
+        }
+    }
+
+    void append(StringView s) {
+        if (!s.empty()) append_to(local(), s.data(), s.length());
+    }
+    void append(char ch) { append_to(local(), &ch, 1); }
+
+    StringBuilder& operator+=(StringView s) { append(s); return *this; }
+    StringBuilder& operator+=(const String& s) { append(StringView(s)); return *this; }
+    StringBuilder& operator+=(const char* s) { append(StringView(s)); return *this; }
+    StringBuilder& operator+=(char ch) { append(ch); return *this; }
+
+    // Собрать результат и очистить сборщик (им можно пользоваться дальше)
+    String finish(MemoryResource* res = MemoryResource::default_resource()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t total = 0;
+        for (size_t i = 0; i < locals_.size(); ++i) total += locals_[i]->bytes;
+
+        String out(res);
+        out.reserve(total); // единственное выделение; может бросить, сборщик не меняется
+        for (size_t i = 0; i < locals_.size(); ++i) {
+            for (Chunk* c = locals_[i]->head; c; c = c->next) out += StringView(chunk_data(c), c->used);
+            release_chunks(locals_[i]);
+        }
+        return out;
+    }
+
+private:
+    static const size_t kFirstChunk = 256;
+    static const size_t kMaxChunk = 64 * 1024;
+
+    struct Chunk {
+        Chunk* next;
+        size_t used;
+        size_t cap;
+    };
+
+    // Блоки одного потока; читаются другими потоками только в finish()
+    struct Local {
+        explicit Local(std::thread::id t) : owner(t), head(nullptr), tail(nullptr), bytes(0), next_cap(kFirstChunk) {}
+
+        std::thread::id owner;
+        Chunk* head;
+        Chunk* tail;
+        size_t bytes;    // суммарная длина записанного
+        size_t next_cap; // размер следующего блока
+    };
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> counter(0);
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    static char* chunk_data(Chunk* c) {
+        return reinterpret_cast<char*>(c) + align_up(sizeof(Chunk), kResourceAlign);
+    }
+
+    // Список блоков текущего потока. Последний использованный сборщик
+    // запоминается в thread_local, поэтому обычно обходится без мьютекса;
+    // id_ (а не адрес) защищает от сборщика, созданного на месте удалённого.
+    Local& local() {
+        struct Cache {
+            uint64_t builder;
+            Local* local;
+        };
+        static thread_local Cache cache = { 0, nullptr };
+        if (cache.builder == id_) return *cache.local;
+
+        std::thread::id self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(mutex_);
+        Local* found = nullptr;
+        for (size_t i = 0; i < locals_.size() && !found; ++i)
+            if (locals_[i]->owner == self) found = locals_[i];
+        if (!found) {
+            found = new Local(self);
+            try {
+                locals_.push_back(found);
+            }
+            catch (...) {
+                delete found;
+                throw;
+            }
+        }
+        cache.builder = id_;
+        cache.local = found;
+        return *found;
+    }
+
+    void append_to(Local& l, const char* src, size_t n) {
+        Chunk* c = l.tail;
+        if (!c || c->cap - c->used < n) {
+            // Большой кусок получает собственный блок нужного размера
+            size_t cap = n > l.next_cap ? n : l.next_cap;
+            Chunk* fresh = static_cast<Chunk*>(res_->allocate(align_up(sizeof(Chunk), kResourceAlign) + cap));
+            fresh->next = nullptr;
+            fresh->used = 0;
+            fresh->cap = cap;
+            if (l.tail) l.tail->next = fresh; else l.head = fresh;
+            l.tail = fresh;
+            if (l.next_cap < kMaxChunk) l.next_cap *= 2;
+            c = fresh;
+        }
+        simd::copy_bytes(chunk_data(c) + c->used, src, n);
+        c->used += n;
+        l.bytes += n;
+    }
+
+    void release_chunks(Local* l) noexcept {
+        Chunk* c = l->head;
+        while (c) {
+            Chunk* next = c->next;
+            res_->deallocate(c, align_up(sizeof(Chunk), kResourceAlign) + c->cap);
+            c = next;
+        }
+        l->head = l->tail = nullptr;
+        l->bytes = 0;
+        l->next_cap = kFirstChunk;
+    }
+
+    MemoryResource* res_;
+    const uint64_t id_;
+    std::mutex mutex_;            // защищает locals_
+    std::vector<Local*> locals_;  // по одному на каждый писавший поток
+};
+
+// -------------------- Параллельные алгоритмы --------------------
+namespace parallel {
+
+// Пул потоков с перехватом задач (work stealing). У каждого рабочего своя
+// очередь: свои задачи он берёт с конца (последние поставленные, их данные
+// ещё в кэше), а когда она пуста — забирает самые старые задачи из чужих
+// очередей. Задача, поставленная из рабочего потока, попадает в его очередь.
+// Задачи, переданные в submit() напрямую, не должны бросать исключений —
+// для этого есть TaskGroup.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    // threads == 0 — по числу аппаратных потоков
+    explicit ThreadPool(unsigned threads = 0) : pending_(0), stop_(false), next_queue_(0) {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; ++i) queues_.emplace_back();
+        try {
+            for (unsigned i = 0; i < threads; ++i)
+                workers_.push_back(std::thread(&ThreadPool::worker_loop, this, static_cast<size_t>(i)));
+        }
+        catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Дожидается выполнения всех поставленных задач
+    ~ThreadPool() { shutdown(); }
+
+    size_t size() const { return queues_.size(); }
+
+    void submit(Task task) {
+        Queue& q = queues_[home_index()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        pending_.fetch_add(1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(sleep_mutex_); } // рабочий не пропустит пробуждение
+        wake_.notify_one();
+    }
+
+    // Выполнить одну задачу в текущем потоке; false, если задач нет.
+    // Позволяет ожидающему потоку помогать пулу, а не простаивать.
+    bool run_one() {
+        Task task;
+        if (!take(home_index(), task)) return false;
+        task();
+        return true;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Пул, которому принадлежит текущий поток, и номер его очереди
+    struct WorkerSlot {
+        const ThreadPool* pool;
+        size_t index;
+    };
+
+    static WorkerSlot& current_worker() {
+        static thread_local WorkerSlot slot = { nullptr, 0 };
+        return slot;
+    }
+
+    // Своя очередь для рабочего потока, по кругу — для внешних потоков
+    size_t home_index() {
+        const WorkerSlot& slot = current_worker();
+        if (slot.pool == this) return slot.index;
+        return next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    }
+
+    bool take(size_t home, Task& out) {
+        if (pending_.load(std::memory_order_acquire) == 0) return false;
+        {
+            Queue& q = queues_[home];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                out = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues_.size(); ++k) {
+            Queue& q = queues_[(home + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                out = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(size_t index) {
+        WorkerSlot& slot = current_worker();
+        slot.pool = this;
+        slot.index = index;
+        for (;;) {
+            Task task;
+            if (take(index, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [this] { return stop_ || pending_.load(std::memory_order_acquire) > 0; });
+            if (stop_ && pending_.load(std::memory_order_acquire) == 0) break;
+        }
+        slot.pool = nullptr;
+    }
+
+    void shutdown() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+        workers_.clear();
+    }
+
+    std::deque<Queue> queues_;    // deque: Queue не перемещаем
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> pending_; // задач в очередях
+    std::mutex sleep_mutex_;      // защищает stop_ и засыпание рабочих
+    std::condition_variable wake_;
+    bool stop_;
+    std::atomic<size_t> next_queue_;
+};
+
+// Группа задач, которых можно дождаться. Ожидающий поток сам выполняет
+// задачи пула, поэтому задачи группы могут порождать новые и ждать их без
+// взаимоблокировки. Первое исключение из задач пробрасывается из wait().
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool), pending_(0) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Задачи ссылаются на группу, поэтому без них она не разрушается
+    ~TaskGroup() { help_until_done(); }
+
+    template <class F>
+    void run(F f) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        try {
+            pool_.submit([this, f] {
+                try {
+                    f();
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex_);
+                    if (!error_) error_ = std::current_exception();
+                }
+                pending_.fetch_sub(1, std::memory_order_acq_rel);
+            });
+        }
+        catch (...) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            throw;
+        }
+    }
+
+    void wait() {
+        help_until_done();
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            error.swap(error_);
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    void help_until_done() {
+        while (pending_.load(std::memory_order_acquire) != 0)
+            if (!pool_.run_one()) std::this_thread::yield();
+    }
+
+    ThreadPool& pool_;
+    std::atomic<size_t> pending_;
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+// Размер части для for_each_chunk: около четырёх частей на поток, но не меньше grain
+inline size_t chunk_size(const ThreadPool& pool, size_t n, size_t grain) {
+    size_t parts = pool.size() * 4;
+    size_t chunk = (n + parts - 1) / parts;
+    return chunk < grain ? grain : chunk;
+}
+
+// f(begin, end) для частей [0, n) размера chunk_size(pool, n, grain), параллельно на пуле
+template <class F>
+void for_each_chunk(ThreadPool& pool, size_t n, size_t grain, F f) {
+    size_t chunk = chunk_size(pool, n, grain);
+    if (n <= chunk) {
+        if (n) f(static_cast<size_t>(0), n);
+        return;
+    }
+    TaskGroup group(pool);
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        size_t end = (n - begin > chunk) ? begin + chunk : n;
+        group.run([=] { f(begin, end); });
+    }
+    group.wait();
+}
+
+namespace detail {
+
+const size_t kRadixBuckets = 257;           // "строка кончилась" + 256 значений байта
+const size_t kSmallSort = 32;               // меньше — сортировка вставками
+const size_t kParallelCutoff = 16 * 1024;   // корзина больше — отдельная задача
+
+// Ключ строки на глубине depth: 0, если строка кончилась, иначе байт + 1
+inline size_t radix_key(const String* s, size_t depth) {
+    return depth < s->length() ? static_cast<unsigned char>(s->c_str()[depth]) + 1 : 0;
+}
+
+// Хвост строки с позиции depth (depth не больше длины)
+inline StringView tail(const String* s, size_t depth) {
+    return StringView(s->c_str() + depth, s->length() - depth);
+}
+
+inline void insertion_sort(String** a, size_t n, size_t depth) {
+    for (size_t i = 1; i < n; ++i) {
+        String* x = a[i];
+        StringView key = tail(x, depth);
+        size_t j = i;
+        while (j > 0 && key.compare(tail(a[j - 1], depth)) < 0) {
+            a[j] = a[j - 1];
+            --j;
+        }
+        a[j] = x;
+    }
+}
+
+inline void msd_sort(String** a, String** tmp, size_t n, size_t depth, TaskGroup& group);
+
+// Отсортировать корзины 1..256 (в корзине 0 все строки равны). Самая
+// большая корзина обрабатывается последней без рекурсии: глубина стека
+// остаётся логарифмической даже для строк с длинными общими префиксами.
+inline void sort_buckets(String** a, String** tmp, const size_t* start, const size_t* count,
+                         size_t& n, size_t depth, TaskGroup& group, String**& next_a, String**& next_tmp) {
+    size_t largest = 0; // 0 — нечего сортировать
+    for (size_t b = 1; b < kRadixBuckets; ++b)
+        if (count[b] > 1 && (largest == 0 || count[b] > count[largest])) largest = b;
+    for (size_t b = 1; b < kRadixBuckets; ++b) {
+        size_t len = count[b];
+        if (len < 2 || b == largest) continue;
+        String** sub = a + start[b];
+        String** sub_tmp = tmp + start[b];
+        if (len >= kParallelCutoff)
+            group.run([=, &group] { msd_sort(sub, sub_tmp, len, depth + 1, group); });
+        else
+            msd_sort(sub, sub_tmp, len, depth + 1, group);
+    }
+    n = largest ? count[largest] : 0;
+    next_a = a + (largest ? start[largest] : 0);
+    next_tmp = tmp + (largest ? start[largest] : 0);
+}
+
+// MSD-поразрядная сортировка указателей по байтам строк начиная с depth
+inline void msd_sort(String** a, String** tmp, size_t n, size_t depth, TaskGroup& group) {
+    while (n > 1) {
+        if (n <= kSmallSort) {
+            insertion_sort(a, n, depth);
+            return;
+        }
+        size_t count[kRadixBuckets] = {};
+        for (size_t i = 0; i < n; ++i) ++count[radix_key(a[i], depth)];
+
+        size_t start[kRadixBuckets];
+        size_t pos[kRadixBuckets];
+        size_t sum = 0;
+        for (size_t b = 0; b < kRadixBuckets; ++b) {
+            start[b] = pos[b] = sum;
+            sum += count[b];
+        }
+        if (count[radix_key(a[0], depth)] == n) { // у всех один и тот же байт
+            if (count[0] == n) return;
+            ++depth;
+            continue;
+        }
+        for (size_t i = 0; i < n; ++i) tmp[pos[radix_key(a[i], depth)]++] = a[i];
+        for (size_t i = 0; i < n; ++i) a[i] = tmp[i];
+
+        sort_buckets(a, tmp, start, count, n, depth, group, a, tmp);
+        ++depth;
+    }
+}
+
+// Первый проход по всему массиву: гистограммы и раскладка по частям параллельно
+inline void parallel_top_level(String** a, String** tmp, size_t n, ThreadPool& pool, TaskGroup& group) {
+    size_t parts = pool.size();
+    size_t chunk = (n + parts - 1) / parts;
+    std::vector<size_t> hist(parts * kRadixBuckets, 0);
+
+    for_each_chunk(pool, n, chunk, [&](size_t begin, size_t end) {
+        size_t* h = &hist[(begin / chunk) * kRadixBuckets];
+        for (size_t i = begin; i < end; ++i) ++h[radix_key(a[i], 0)];
+    });
+
+    // Смещения: корзина за корзиной, внутри корзины — части по порядку
+    size_t start[kRadixBuckets];
+    size_t count[kRadixBuckets];
+    std::vector<size_t> offset(parts * kRadixBuckets);
+    size_t sum = 0;
+    for (size_t b = 0; b < kRadixBuckets; ++b) {
+        start[b] = sum;
+        for (size_t p = 0; p < parts; ++p) {
+            offset[p * kRadixBuckets + b] = sum;
+            sum += hist[p * kRadixBuckets + b];
+        }
+        count[b] = sum - start[b];
+    }
+
+    for_each_chunk(pool, n, chunk, [&](size_t begin, size_t end) {
+        size_t* pos = &offset[(begin / chunk) * kRadixBuckets];
+        for (size_t i = begin; i < end; ++i) tmp[pos[radix_key(a[i], 0)]++] = a[i];
+    });
+    for_each_chunk(pool, n, kParallelCutoff, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) a[i] = tmp[i];
+    });
+
+    String** rest = nullptr;
+    String** rest_tmp = nullptr;
+    size_t rest_n = n;
+    sort_buckets(a, tmp, start, count, rest_n, 0, group, rest, rest_tmp);
+    msd_sort(rest, rest_tmp, rest_n, 1, group);
+}
+
+// Переместить строки в порядке order в новый массив и подменить им v
+inline void permute(std::vector<String>& v, String* const* order, size_t n, ThreadPool& pool) {
+    std::vector<String> out(n);
+    for_each_chunk(pool, n, kParallelCutoff, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) out[i] = std::move(*order[i]);
+    });
+    v.swap(out);
+}
+
+} // namespace detail
+
+// Многопоточная MSD-поразрядная сортировка (тот же порядок, что у operator<).
+// Сортируются указатели по сырым байтам строк, сами String перемещаются один
+// раз в конце; корзины крупнее kParallelCutoff обрабатываются на пуле.
+inline void sort(std::vector<String>& v, ThreadPool& pool) {
+    size_t n = v.size();
+    if (n < 2) return;
+    std::vector<String*> order(n);
+    std::vector<String*> tmp(n);
+    for (size_t i = 0; i < n; ++i) order[i] = &v[i];
+    {
+        TaskGroup group(pool);
+        if (n >= detail::kParallelCutoff && pool.size() > 1)
+            detail::parallel_top_level(&order[0], &tmp[0], n, pool, group);
+        else
+            detail::msd_sort(&order[0], &tmp[0], n, 0, group);
+        group.wait();
+    }
+    detail::permute(v, &order[0], n, pool);
+}
+
+// Отсортировать и удалить повторы; возвращает число оставшихся строк.
+// Каждая часть массива независимо считает и переносит первые вхождения.
+inline size_t dedupe(std::vector<String>& v, ThreadPool& pool) {
+    sort(v, pool);
+    size_t n = v.size();
+    if (n < 2) return n;
+
+    const size_t grain = chunk_size(pool, n, detail::kParallelCutoff); // части ровно такого размера
+    size_t parts = (n + grain - 1) / grain;
+    std::vector<size_t> kept(parts + 1, 0);
+    std::vector<char> first(n); // флаги отдельно: перемещать можно только после всех сравнений
+    for_each_chunk(pool, n, grain, [&](size_t begin, size_t end) {
+        size_t k = 0;
+        for (size_t i = begin; i < end; ++i) {
+            first[i] = (i == 0 || v[i] != v[i - 1]);
+            k += first[i];
+        }
+        kept[begin / grain + 1] = k;
+    });
+    for (size_t p = 0; p < parts; ++p) kept[p + 1] += kept[p]; // начало вывода каждой части
+
+    std::vector<String> out(kept[parts]);
+    for_each_chunk(pool, n, grain, [&](size_t begin, size_t end) {
+        size_t pos = kept[begin / grain];
+        for (size_t i = begin; i < end; ++i)
+            if (first[i]) out[pos++] = std::move(v[i]);
+    });
+    v.swap(out);
+    return v.size();
+}
+
+// out[i] = a[i].unique_chars_with(b[i], range) для всех пар, параллельно на пуле.
+// out — заранее созданный массив из count строк (их буферы переиспользуются).
+inline void unique_chars_pairs(const String* a, const String* b, size_t count, String* out,
+                               ThreadPool& pool, CharRange range = CharRange::Ascii) {
+    for_each_chunk(pool, count, 64, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) a[i].unique_chars_with(b[i], out[i], range);
+    });
+}
+
+} // namespace parallel
+
+// -------------------- Строки текста --------------------
+// Обход текста по строкам без копирования. Разделитель — '\n', завершающий
+// '\r' (CRLF) отбрасывается; после последнего '\n' пустая строка не появляется.
+class LineIterator {
+public:
+    LineIterator() : has_line_(false) {} // конец
+    explicit LineIterator(StringView text) : rest_(text), has_line_(true) { advance(); }
+
+    StringView operator*() const { return line_; }
+    LineIterator& operator++() { advance(); return *this; }
+
+    bool operator==(const LineIterator& other) const {
+        return has_line_ == other.has_line_ && (!has_line_ || line_.data() == other.line_.data());
+    }
+    bool operator!=(const LineIterator& other) const { return !(*this == other); }
+
+private:
+    void advance() {
+        if (rest_.empty()) {
+            has_line_ = false;
+            return;
+        }
+        size_t n = simd::find_byte(rest_.data(), rest_.length(), '\n');
+        size_t len = (n > 0 && rest_[n - 1] == '\r') ? n - 1 : n;
+        line_ = StringView(rest_.data(), len);
+        rest_ = (n < rest_.length()) ? StringView(rest_.data() + n + 1, rest_.length() - n - 1) : StringView();
+    }
+
+    StringView rest_;
+    StringView line_;
+    bool has_line_;
+};
+
+class LineRange {
+public:
+    explicit LineRange(StringView text) : text_(text) {}
+    LineIterator begin() const { return LineIterator(text_); }
+    LineIterator end() const { return LineIterator(); }
+
+private:
+    StringView text_;
+};
+
+// -------------------- Таблица строк --------------------
+// Колоночное хранилище множества коротких строк: все байты подряд в одном
+// буфере, границы элементов — в массиве смещений. Проход по таблице читает
+// память последовательно, без перехода по указателю на каждый элемент.
+// Взгляды на элементы действительны до следующего изменения таблицы.
+class StringTable {
+public:
+    class const_iterator {
+    public:
+        const_iterator(const StringTable* table, size_t index) : table_(table), index_(index) {}
+        StringView operator*() const { return table_->view_at(index_); }
+        const_iterator& operator++() { ++index_; return *this; }
+        bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+    private:
+        const StringTable* table_;
+        size_t index_;
+    };
+
+    explicit StringTable(MemoryResource* res = MemoryResource::default_resource())
+        : blob_(res), offsets_(1, 0) {}
+
+    size_t size() const { return offsets_.size() - 1; }
+    bool empty() const { return size() == 0; }
+    size_t bytes() const { return blob_.length(); } // суммарная длина всех строк
+
+    void reserve(size_t count, size_t bytes) {
+        offsets_.reserve(count + 1);
+        blob_.reserve(bytes);
+    }
+
+    // Добавить строку в конец; возвращает её номер. s может ссылаться на
+    // элемент этой же таблицы.
+    size_t push_back(StringView s) {
+        offsets_.push_back(blob_.length() + s.length()); // может бросить
+        try {
+            blob_ += s;
+        }
+        catch (...) {
+            offsets_.pop_back();
+            throw;
+        }
+        return size() - 1;
+    }
+
+    // Добавить все строки текста (см. LineIterator); возвращает их число.
+    // Место под смещения и байты резервируется заранее одним подсчётом '\n'.
+    // text не должен указывать внутрь этой таблицы.
+    size_t append_lines(StringView text) {
+        size_t count = 0;
+        for (size_t pos = 0; pos < text.length(); ++count)
+            pos += simd::find_byte(text.data() + pos, text.length() - pos, '\n') + 1;
+        reserve(size() + count, bytes() + text.length());
+        for (StringView line : LineRange(text)) push_back(line);
+        return count;
+    }
+
+    // Без проверки границ в Release, как и String::operator[] при IND3_CHECKED_INDEX=0
+    StringView operator[](size_t index) const {
+        assert(index < size());
+        return view_at(index);
+    }
+
+    StringView at(size_t index) const {
+        if (index >= size()) throw std::out_of_range("StringTable::at: index out of range");
+        return view_at(index);
+    }
 
-    // Выделить буфер ёмкости cap (cap символов + 1 для '\0').
-    // Может бросить std::bad_alloc при неудаче new.
-    static char* allocate_buffer(size_t cap) {
-        char* buf = new char[cap + 1]; // выделяем cap + 1 байт
-        buf[0] = '\0';                 // делаем корректной пустую C-строку
-        return buf;
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    // Лексикографическое сравнение двух элементов: <0, 0, >0
+    int compare(size_t i, size_t j) const { return view_at(i).compare(view_at(j)); }
+
+    // Устойчивая сортировка по возрастанию (порядок String::operator<).
+    // Сортируются номера элементов, затем байты перекладываются в новом
+    // порядке, чтобы последующие проходы снова шли подряд по памяти.
+    void sort() {
+        size_t n = size();
+        if (n < 2) return;
+        std::vector<size_t> order(n);
+        std::vector<size_t> tmp(n);
+        for (size_t i = 0; i < n; ++i) order[i] = i;
+
+        // Восходящая сортировка слиянием: серии по 1, 2, 4, ... элемента
+        for (size_t width = 1; width < n; width *= 2) {
+            for (size_t lo = 0; lo < n; lo += 2 * width) {
+                size_t mid = (lo + width < n) ? lo + width : n;
+                size_t hi = (mid + width < n) ? mid + width : n;
+                size_t a = lo, b = mid, out = lo;
+                while (a < mid && b < hi) tmp[out++] = (compare(order[b], order[a]) < 0) ? order[b++] : order[a++];
+                while (a < mid) tmp[out++] = order[a++];
+                while (b < hi) tmp[out++] = order[b++];
+            }
+            order.swap(tmp);
+        }
+
+        String blob(blob_.get_resource());
+        blob.reserve(blob_.length());
+        std::vector<size_t> offsets;
+        offsets.reserve(n + 1);
+        offsets.push_back(0);
+        for (size_t i = 0; i < n; ++i) {
+            blob += view_at(order[i]);
+            offsets.push_back(blob.length());
+        }
+        swap(blob_, blob);
+        offsets_.swap(offsets);
     }
 
-    // Вспомогательная функция: лексикографическое сравнение
-    int compare_lex(const String& other) const {
-        size_t i = 0;
-        size_t n = (length_ < other.length_) ? length_ : other.length_;
-        for (; i < n; ++i) {
-            unsigned char a = static_cast<unsigned char>(data_[i]);
-            unsigned char b = static_cast<unsigned char>(other.data_[i]);
-            if (a != b) return (a < b) ? -1 : 1;
+    // Номер первого элемента, не меньшего key; таблица должна быть отсортирована
+    size_t lower_bound(StringView key) const {
+        size_t lo = 0, hi = size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (view_at(mid).compare(key) < 0) lo = mid + 1;
+            else hi = mid;
         }
-        if (length_ == other.length_) return 0;
-        return (length_ < other.length_) ? -1 : 1;
+        return lo;
+    }
+
+    // Поэлементное сравнение таблиц равно сравнению смещений и общего буфера
+    bool operator==(const StringTable& other) const {
+        return offsets_ == other.offsets_ && blob_ == other.blob_;
+    }
+    bool operator!=(const StringTable& other) const { return !(*this == other); }
+
+    void clear() {
+        blob_.clear();
+        offsets_.resize(1);
+    }
+
+private:
+    StringView view_at(size_t i) const {
+        return StringView(blob_.c_str() + offsets_[i], offsets_[i + 1] - offsets_[i]);
     }
 
+    String blob_;                 // байты всех строк подряд, без разделителей
+    std::vector<size_t> offsets_; // offsets_[i] — начало i-й строки, offsets_[size()] == bytes()
+};
+
+// -------------------- Файлы в памяти --------------------
+// Содержимое файла только для чтения. Обычный файл отображается в память
+// (mmap / MapViewOfFile), и байты не копируются: страницы подгружаются по
+// мере обращения. Если отобразить нельзя (канал, пустой или специальный файл,
+// IND3_NO_MMAP), файл читается потоком в собственный буфер String.
+// Взгляды из view() и lines() действительны, пока жив объект.
+class MappedFile {
 public:
-    // -------------------- Конструкторы / деструктор --------------------
+    explicit MappedFile(const char* path, MemoryResource* res = MemoryResource::default_resource())
+        : data_(nullptr), size_(0), fallback_(res) {
+        if (!map(path)) read_stream(path);
+    }
 
-    // Конструктор по умолчанию: пустая строка
-    String()
-        : data_(allocate_buffer(0)), length_(0), capacity_(0) {}
+    MappedFile(MappedFile&& other) noexcept
+        : data_(other.data_), size_(other.size_), fallback_(std::move(other.fallback_)) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
 
-    // Конструктор из C-строки (const char*)
-    String(const char* str)
-        : data_(nullptr), length_(0), capacity_(0)
-    {
-        if (!str) { // nullptr трактуем как пустую строку
-            data_ = allocate_buffer(0);
-            length_ = 0;
-            capacity_ = 0;
-            return;
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = other.data_;
+            size_ = other.size_;
+            fallback_ = std::move(other.fallback_);
+            other.data_ = nullptr;
+            other.size_ = 0;
         }
-        // вычисляем длину вручную (без <cstring>)
-        const char* p = str;
-        size_t len = 0;
-        while (*p) { ++len; ++p; }
+        return *this;
+    }
 
-        char* buf = allocate_buffer(len); // может бросить
-        for (size_t i = 0; i < len; ++i) buf[i] = str[i];
-        buf[len] = '\0';
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
-        data_ = buf;
-        length_ = len;
-        capacity_ = len;
+    ~MappedFile() { unmap(); }
+
+    StringView view() const { return data_ ? StringView(data_, size_) : fallback_.view(); }
+    const char* data() const { return view().data(); }
+    size_t size() const { return data_ ? size_ : fallback_.length(); }
+    bool is_mapped() const { return data_ != nullptr; }
+
+    LineRange lines() const { return LineRange(view()); }
+
+private:
+    // true, если файл отображён; иначе вызывающий читает его потоком
+    bool map(const char* path) {
+#if defined(IND3_MMAP_POSIX)
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t size = static_cast<size_t>(st.st_size);
+            void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, size, MADV_SEQUENTIAL); // подсказка: читать наперёд
+                data_ = static_cast<const char*>(p);
+                size_ = size;
+            }
+        }
+        ::close(fd); // отображение остаётся действительным и без дескриптора
+        return data_ != nullptr;
+#elif defined(IND3_MMAP_WIN32)
+        HANDLE file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                    FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (::GetFileSizeEx(file, &size) && size.QuadPart > 0 &&
+            static_cast<unsigned long long>(size.QuadPart) <= static_cast<size_t>(-1)) {
+            HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                void* p = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (p) {
+                    data_ = static_cast<const char*>(p);
+                    size_ = static_cast<size_t>(size.QuadPart);
+                }
+                ::CloseHandle(mapping); // вид держит отображение до UnmapViewOfFile
+            }
+        }
+        ::CloseHandle(file);
+        return data_ != nullptr;
+#else
+        (void)path;
+        return false;
+#endif
     }
 
-    // Копирующий конструктор (глубокое копирование)
-    String(const String& other)
-        : data_(nullptr), length_(other.length_), capacity_(other.capacity_)
-    {
-        char* buf = allocate_buffer(capacity_); // может бросить
-        for (size_t i = 0; i < length_; ++i) buf[i] = other.data_[i];
-        buf[length_] = '\0';
-        data_ = buf;
+    void unmap() noexcept {
+        if (!data_) return;
+#if defined(IND3_MMAP_POSIX)
+        ::munmap(const_cast<char*>(data_), size_);
+#elif defined(IND3_MMAP_WIN32)
+        ::UnmapViewOfFile(data_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
     }
 
-    // Перемещающий конструктор (без noexcept в этой реализации)
-    String(String&& other)
-        : data_(other.data_), length_(other.length_), capacity_(other.capacity_)
-    {
-        // Оставляем other в корректном пустом состоянии.
-        // Здесь выделяется пустой буфер; это может бросить std::bad_alloc.
-        other.data_ = allocate_buffer(0);
-        other.length_ = 0;
-        other.capacity_ = 0;
+    void read_stream(const char* path) {
+        std::FILE* f = nullptr;
+#if defined(_MSC_VER)
+        if (fopen_s(&f, path, "rb") != 0) f = nullptr;
+#else
+        f = std::fopen(path, "rb");
+#endif
+        if (!f) throw std::runtime_error("MappedFile: cannot open file");
+        char chunk[16 * 1024];
+        try {
+            size_t got;
+            while ((got = std::fread(chunk, 1, sizeof(chunk), f)) > 0) fallback_ += StringView(chunk, got);
+        }
+        catch (...) {
+            std::fclose(f);
+            throw;
+        }
+        bool failed = std::ferror(f) != 0;
+        std::fclose(f);
+        if (failed) throw std::runtime_error("MappedFile: read error");
     }
 
-    // Деструктор: освобождаем память
-    ~String() {
-        delete[] data_;
+    const char* data_; // отображённые байты или nullptr
+    size_t size_;
+    String fallback_;  // содержимое, прочитанное потоком
+};
+
+inline MappedFile String::map_file(const char* path, MemoryResource* res) { return MappedFile(path, res); }
+
+// -------------------- Строки времени компиляции --------------------
+// Строка ёмкости N символов без выделений памяти. Все операции, кроме
+// перевода в String/StringView, — constexpr (хватает C++14), поэтому ключи
+// конфигурации и эталонные наборы для unique_chars_with можно вычислить при
+// компиляции. Длина — от 0 до N, за последним символом всегда '\0'.
+// В String переводится одним копированием: to_string() или String(fixed).
+template <size_t N>
+class FixedString {
+public:
+    constexpr FixedString() : data_{}, length_(0) {}
+
+    // Из строкового литерала не длиннее N (проверяется при компиляции)
+    template <size_t M>
+    constexpr FixedString(const char (&str)[M]) : data_{}, length_(0) {
+        static_assert(M - 1 <= N, "FixedString: literal is longer than capacity");
+        for (size_t i = 0; i + 1 < M && str[i]; ++i) data_[length_++] = str[i];
     }
 
-    // -------------------- Доступ и операторы --------------------
+    // Из FixedString меньшей или равной ёмкости
+    template <size_t M>
+    constexpr FixedString(const FixedString<M>& other) : data_{}, length_(0) {
+        static_assert(M <= N, "FixedString: source capacity exceeds destination capacity");
+        for (size_t i = 0; i < other.length_; ++i) data_[length_++] = other.data_[i];
+    }
 
-    size_t length() const { return length_; }
-    bool empty() const { return length_ == 0; }
+    // Из указателя и длины; длина больше N — std::out_of_range
+    // (в константном выражении — ошибка компиляции)
+    constexpr FixedString(const char* str, size_t len) : data_{}, length_(0) {
+        if (len > N) throw std::out_of_range("FixedString: length exceeds capacity");
+        for (size_t i = 0; i < len; ++i) data_[length_++] = str[i];
+    }
 
-    // operator[] с проверкой границ (бросает std::out_of_range)
-    char& operator[](size_t index) {
-        if (index >= length_) {
-            throw std::out_of_range("String::operator[]: index out of range");
+    static constexpr size_t capacity() { return N; }
+    constexpr size_t length() const { return length_; }
+    constexpr bool empty() const { return length_ == 0; }
+    constexpr const char* c_str() const { return data_; }
+    constexpr const char* data() const { return data_; }
+
+    // Без проверки границ, как StringView::operator[]
+    constexpr char operator[](size_t index) const { return data_[index]; }
+
+    StringView view() const { return StringView(data_, length_); }
+    operator StringView() const { return view(); }
+    String to_string(MemoryResource* res = MemoryResource::default_resource()) const { return String(view(), res); }
+
+    // Лексикографическое сравнение (как StringView::compare): <0, 0, >0
+    template <size_t M>
+    constexpr int compare(const FixedString<M>& other) const {
+        size_t n = length_ < other.length_ ? length_ : other.length_;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char a = static_cast<unsigned char>(data_[i]);
+            unsigned char b = static_cast<unsigned char>(other.data_[i]);
+            if (a != b) return a < b ? -1 : 1;
         }
-        return data_[index];
+        if (length_ == other.length_) return 0;
+        return length_ < other.length_ ? -1 : 1;
     }
-    const char& operator[](size_t index) const {
-        if (index >= length_) {
-            throw std::out_of_range("String::operator[] const: index out of range");
-        }
-        return data_[index];
+
+    template <size_t M>
+    constexpr bool operator==(const FixedString<M>& other) const { return length_ == other.length_ && compare(other) == 0; }
+    template <size_t M>
+    constexpr bool operator!=(const FixedString<M>& other) const { return !(*this == other); }
+    template <size_t M>
+    constexpr bool operator<(const FixedString<M>& other) const { return compare(other) < 0; }
+    template <size_t M>
+    constexpr bool operator>(const FixedString<M>& other) const { return compare(other) > 0; }
+
+    // Конкатенация: ёмкость результата — сумма ёмкостей
+    template <size_t M>
+    constexpr FixedString<N + M> operator+(const FixedString<M>& other) const {
+        FixedString<N + M> result;
+        for (size_t i = 0; i < length_; ++i) result.push_back_unchecked(data_[i]);
+        for (size_t i = 0; i < other.length_; ++i) result.push_back_unchecked(other.data_[i]);
+        return result;
     }
 
-    const char* c_str() const { return data_; }
+    template <size_t M>
+    constexpr FixedString<N + M - 1> operator+(const char (&str)[M]) const { return *this + FixedString<M - 1>(str); }
 
-    // -------------------- swap и присваивания --------------------
+    // То же, что String::unique_chars_with: все вхождения символов обеих
+    // строк, которых нет в другой строке, с сохранением порядка
+    template <size_t M>
+    constexpr FixedString<N + M> unique_chars_with(const FixedString<M>& other,
+                                                   CharRange range = CharRange::Ascii) const {
+        bool in_this[256] = {};
+        bool in_other[256] = {};
+        for (size_t i = 0; i < length_; ++i) in_this[static_cast<unsigned char>(data_[i])] = true;
+        for (size_t i = 0; i < other.length_; ++i) in_other[static_cast<unsigned char>(other.data_[i])] = true;
 
-    friend void swap(String& a, String& b) noexcept {
-        using std::swap;
-        swap(a.data_, b.data_);
-        swap(a.length_, b.length_);
-        swap(a.capacity_, b.capacity_);
+        FixedString<N + M> result;
+        for (size_t i = 0; i < length_; ++i) {
+            unsigned char c = static_cast<unsigned char>(data_[i]);
+            if ((range == CharRange::AllBytes || c < 128) && !in_other[c]) result.push_back_unchecked(data_[i]);
+        }
+        for (size_t i = 0; i < other.length_; ++i) {
+            unsigned char c = static_cast<unsigned char>(other.data_[i]);
+            if ((range == CharRange::AllBytes || c < 128) && !in_this[c]) result.push_back_unchecked(other.data_[i]);
+        }
+        return result;
     }
 
-    // copy-and-swap
-    String& operator=(const String& other) {
-        if (this != &other) {
-            String tmp(other); // может бросить
-            swap(*this, tmp);
+private:
+    template <size_t> friend class FixedString;
+
+    // Вызывающий гарантирует length_ < N
+    constexpr void push_back_unchecked(char ch) { data_[length_++] = ch; }
+
+    char data_[N + 1];
+    size_t length_;
+};
+
+// FixedString точно по длине литерала: make_fixed("key") -> FixedString<3>
+template <size_t M>
+constexpr FixedString<M - 1> make_fixed(const char (&str)[M]) { return FixedString<M - 1>(str); }
+
+// Проверка при компиляции: тот же пример, что в main
+static_assert(make_fixed("abracadabra").unique_chars_with(make_fixed("barbar")) == make_fixed("cd"),
+    "constexpr unique_chars_with must match String::unique_chars_with");
+
+// -------------------- Цепочка буферов (scatter-gather) --------------------
+// Буфер ввода-вывода платформы: WSABUF для WSASend, iovec для writev/sendmsg
+#if defined(_WIN32)
+typedef WSABUF IoBuffer;
+const size_t kMaxIoBufferLength = 0xFFFFFFFFu; // WSABUF::len — ULONG
+
+inline IoBuffer make_io_buffer(const char* p, size_t n) {
+    IoBuffer b;
+    b.buf = const_cast<char*>(p);
+    b.len = static_cast<ULONG>(n);
+    return b;
+}
+#else
+#if defined(IND3_HAS_IOVEC)
+typedef struct iovec IoBuffer;
+#else
+struct IoBuffer {
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
+const size_t kMaxIoBufferLength = static_cast<size_t>(-1);
+
+inline IoBuffer make_io_buffer(const char* p, size_t n) {
+    IoBuffer b;
+    b.iov_base = const_cast<char*>(p);
+    b.iov_len = n;
+    return b;
+}
+#endif
+
+#if defined(IND3_COROUTINES)
+// Генератор кусков строки на корутинах C++20:
+//     StringGenerator render() { co_yield String("HTTP/1.1 200 OK\r\n"); ... }
+//     chain.append(render());
+// Корутина запускается лениво и продвигается на один co_yield за next().
+class StringGenerator {
+public:
+    struct promise_type {
+        String current;
+        std::exception_ptr error;
+
+        StringGenerator get_return_object() {
+            return StringGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(String piece) noexcept {
+            current = std::move(piece);
+            return {};
         }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    StringGenerator(StringGenerator&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    StringGenerator(const StringGenerator&) = delete;
+    StringGenerator& operator=(const StringGenerator&) = delete;
+    StringGenerator& operator=(StringGenerator&&) = delete;
+
+    ~StringGenerator() {
+        if (handle_) handle_.destroy();
+    }
+
+    // Следующий кусок в out; false, когда корутина завершилась.
+    // Исключение из корутины пробрасывается отсюда.
+    bool next(String& out) {
+        if (!handle_ || handle_.done()) return false;
+        handle_.resume();
+        if (handle_.promise().error) std::rethrow_exception(handle_.promise().error);
+        if (handle_.done()) return false;
+        out = std::move(handle_.promise().current);
+        return true;
+    }
+
+private:
+    explicit StringGenerator(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+#endif
+
+// Ответ, собранный из кусков без склейки. Куски String забираются во
+// владение перемещением (байты в куче не копируются), чужие байты можно
+// добавить по ссылке. io_buffers() отдаёт куски как iovec/WSABUF для
+// writev/WSASend, consume() продвигает начало после частичной отправки,
+// flatten() склеивает всё одним выделением, если строка всё же нужна целиком.
+class StringChain {
+public:
+    explicit StringChain(MemoryResource* res = MemoryResource::default_resource())
+        : res_(res), head_(0), head_offset_(0), length_(0) {}
+
+    // Куски ссылаются на строки в owned_ (и на их внутренние буферы), поэтому
+    // копия ссылалась бы на чужие строки. Перемещение deque оставляет строки
+    // на месте, и ссылки остаются верными; исходная цепочка становится пустой.
+    StringChain(const StringChain&) = delete;
+    StringChain& operator=(const StringChain&) = delete;
+
+    StringChain(StringChain&& other)
+        : res_(other.res_), owned_(std::move(other.owned_)), pieces_(std::move(other.pieces_)),
+          head_(other.head_), head_offset_(other.head_offset_), length_(other.length_) {
+        other.clear();
+    }
+
+    StringChain& operator=(StringChain&& other) {
+        if (this == &other) return *this;
+        res_ = other.res_;
+        owned_ = std::move(other.owned_);
+        pieces_ = std::move(other.pieces_);
+        head_ = other.head_;
+        head_offset_ = other.head_offset_;
+        length_ = other.length_;
+        other.clear();
         return *this;
     }
 
-    // move-assign (без noexcept)
-    String& operator=(String&& other) {
-        if (this != &other) {
-            delete[] data_;
-            data_ = other.data_;
-            length_ = other.length_;
-            capacity_ = other.capacity_;
-            other.data_ = allocate_buffer(0);
-            other.length_ = 0;
-            other.capacity_ = 0;
+    // Забрать строку во владение (короткая строка копирует свои до 15 байт)
+    StringChain& append(String&& piece) {
+        if (piece.empty()) return *this;
+        owned_.push_back(std::move(piece)); // может бросить
+        try {
+            push_piece(owned_.back().view(), true);
+        }
+        catch (...) {
+            owned_.pop_back();
+            throw;
         }
         return *this;
     }
 
-    // Присваивание из C-строки
-    String& operator=(const char* str) {
-        String tmp(str); // может бросить
-        swap(*this, tmp);
+    // Скопировать байты в собственный кусок (для коротких фрагментов)
+    StringChain& append_copy(StringView piece) { return append(String(piece, res_)); }
+
+    // Сослаться на чужие байты без копирования: они должны жить, пока
+    // цепочка не отправлена или не очищена
+    StringChain& append_ref(StringView piece) {
+        if (!piece.empty()) push_piece(piece, false);
         return *this;
     }
 
-    // -------------------- Операции со строками --------------------
+    StringChain& operator+=(String&& piece) { return append(std::move(piece)); }
 
-    // Конкатенация: возвращает новую строку, равную this + other
-    String operator+(const String& other) const {
-        size_t newlen = length_ + other.length_;
-        char* buf = allocate_buffer(newlen); // может бросить
-        for (size_t i = 0; i < length_; ++i) buf[i] = data_[i];
-        for (size_t j = 0; j < other.length_; ++j) buf[length_ + j] = other.data_[j];
-        buf[newlen] = '\0';
-        String result;
-        delete[] result.data_;
-        result.data_ = buf;
-        result.length_ = newlen;
-        result.capacity_ = newlen;
-        return result;
+#if defined(IND3_COROUTINES)
+    // Забрать все куски, которые выдаст генератор
+    StringChain& append(StringGenerator gen) {
+        String piece(res_);
+        while (gen.next(piece)) append(std::move(piece));
+        return *this;
     }
+#endif
 
-    // this += other
-    String& operator+=(const String& other) {
-        size_t needed = length_ + other.length_;
-        if (needed > capacity_) {
-            size_t newcap = capacity_ == 0 ? 1 : capacity_ * 2;
-            while (newcap < needed) newcap *= 2;
-            reserve(newcap); // может бросить
+    size_t length() const { return length_; } // ещё не отправленные байты
+    bool empty() const { return length_ == 0; }
+    size_t piece_count() const { return pieces_.size() - head_; }
+
+    // i-й неотправленный кусок (первый — без уже отправленного начала)
+    StringView piece(size_t i) const {
+        StringView v = pieces_[head_ + i].view;
+        return i == 0 ? StringView(v.data() + head_offset_, v.length() - head_offset_) : v;
+    }
+
+    // Записать в out до max буферов, начиная с первого неотправленного байта
+    // (для writev max не больше IOV_MAX). Кусок длиннее предела платформы
+    // делится на несколько буферов. Возвращает число заполненных.
+    size_t io_buffers(IoBuffer* out, size_t max) const {
+        size_t filled = 0;
+        for (size_t i = 0; i < piece_count() && filled < max; ++i) {
+            StringView v = piece(i);
+            for (size_t pos = 0; pos < v.length() && filled < max;) {
+                size_t n = v.length() - pos < kMaxIoBufferLength ? v.length() - pos : kMaxIoBufferLength;
+                out[filled++] = make_io_buffer(v.data() + pos, n);
+                pos += n;
+            }
         }
-        for (size_t i = 0; i < other.length_; ++i) data_[length_ + i] = other.data_[i];
-        length_ = needed;
-        data_[length_] = '\0';
-        return *this;
+        return filled;
     }
 
-    // this += C-строка
-    String& operator+=(const char* str) {
-        if (!str) return *this;
-        const char* p = str;
-        size_t len = 0;
-        while (*p) { ++len; ++p; }
-        size_t needed = length_ + len;
-        if (needed > capacity_) {
-            size_t newcap = capacity_ == 0 ? 1 : capacity_ * 2;
-            while (newcap < needed) newcap *= 2;
-            reserve(newcap); // может бросить
-        }
-        for (size_t i = 0; i < len; ++i) data_[length_ + i] = str[i];
-        length_ = needed;
-        data_[length_] = '\0';
-        return *this;
+    // Отметить первые n байт отправленными (результат writev/WSASend).
+    // Полностью отправленные собственные куски сразу освобождаются.
+    void consume(size_t n) {
+        if (n > length_) throw std::out_of_range("StringChain::consume: more bytes than queued");
+        length_ -= n;
+        while (n) {
+            size_t rest = pieces_[head_].view.length() - head_offset_;
+            if (n < rest) {
+                head_offset_ += n;
+                return;
+            }
+            n -= rest;
+            pop_head();
+        }
+        while (head_ < pieces_.size() && pieces_[head_].view.length() == head_offset_) pop_head();
+    }
+
+    // Склеить неотправленные байты в одну строку точного размера
+    String flatten() const { return flatten(res_); }
+
+    String flatten(MemoryResource* res) const {
+        String out(res);
+        out.reserve(length_); // единственное выделение
+        for (size_t i = 0; i < piece_count(); ++i) out += piece(i);
+        return out;
     }
 
-    // Очистить строку (сделать пустой)
     void clear() {
-        length_ = 0;
-        if (data_) data_[0] = '\0';
+        owned_.clear();
+        pieces_.clear();
+        head_ = head_offset_ = length_ = 0;
     }
 
-    // -------------------- Сравнения --------------------
+private:
+    struct Piece {
+        StringView view;
+        bool owned; // байты в owned_ (в том же порядке, что и куски)
+    };
 
-    bool operator==(const String& other) const {
-        if (length_ != other.length_) return false;
-        for (size_t i = 0; i < length_; ++i)
-            if (data_[i] != other.data_[i]) return false;
-        return true;
+    void push_piece(StringView v, bool owned) {
+        Piece p = { v, owned };
+        pieces_.push_back(p); // может бросить
+        length_ += v.length();
     }
 
-    bool operator!=(const String& other) const { return !(*this == other); }
-    bool operator<(const String& other) const { return compare_lex(other) < 0; }
-    bool operator>(const String& other) const { return compare_lex(other) > 0; }
+    void pop_head() {
+        if (pieces_[head_].owned) owned_.pop_front();
+        ++head_;
+        head_offset_ = 0;
+        if (head_ == pieces_.size()) { // всё отправлено: массив начинается заново
+            pieces_.clear();
+            head_ = 0;
+        }
+    }
 
-    // -------------------- Дополнительные методы --------------------
+    MemoryResource* res_;
+    std::deque<String> owned_;  // deque: адреса строк стабильны, на них ссылаются pieces_
+    std::vector<Piece> pieces_;
+    size_t head_;        // первый неотправленный кусок
+    size_t head_offset_; // сколько байт первого куска уже отправлено
+    size_t length_;
+};
 
-    void reserve(size_t new_cap) {
-        if (new_cap <= capacity_) return;
-        char* buf = allocate_buffer(new_cap); // может бросить
-        for (size_t i = 0; i < length_; ++i) buf[i] = data_[i];
-        buf[length_] = '\0';
-        delete[] data_;
-        data_ = buf;
-        capacity_ = new_cap;
+// Перемещение не должно бросать: от этого зависит поведение контейнеров STL
+static_assert(std::is_nothrow_move_constructible<String>::value,
+    "String move constructor must be noexcept");
+static_assert(std::is_nothrow_move_assignable<String>::value,
+    "String move assignment must be noexcept");
+
+// -------------------- Бенчмарки --------------------
+// Запуск: ind3.exe --bench, либо отдельный проект ind3_bench (IND3_BENCH_MAIN)
+namespace bench {
+
+// Не даёт компилятору выбросить результат замеряемого кода
+volatile char g_sink;
+
+// Среднее время одной итерации f() в наносекундах
+template <class F>
+double time_per_op_ns(size_t iters, F f) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) f();
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / static_cast<double>(iters);
+}
+
+// Пропускная способность копирования: побайтовый цикл против simd::copy_bytes,
+// а также конкатенация двух больших строк
+void run_copy() {
+    std::cout << "copy benchmark (kernel: " << simd::kernel_name() << ")\n";
+    const size_t kMax = 1024 * 1024;
+    char* src = new char[kMax];
+    char* dst = new char[kMax];
+    for (size_t i = 0; i < kMax; ++i) src[i] = static_cast<char>('a' + i % 26);
+
+    for (size_t size = 1024; size <= kMax; size *= 4) {
+        size_t iters = (64 * 1024 * 1024) / size; // ~64 МБ на замер
+        double scalar_ns = time_per_op_ns(iters, [&] {
+            simd::copy_scalar(dst, src, size);
+            g_sink = dst[size - 1];
+        });
+        double simd_ns = time_per_op_ns(iters, [&] {
+            simd::copy_bytes(dst, src, size);
+            g_sink = dst[size - 1];
+        });
+
+        src[size - 1] = '\0';
+        String half(src + size / 2);
+        src[size - 1] = 'x';
+        double concat_ns = time_per_op_ns(iters, [&] {
+            String joined = half + half;
+            g_sink = joined.c_str()[0];
+        });
+
+        std::cout << "  " << size / 1024 << " KB: scalar "
+                  << size / scalar_ns << " GB/s, simd " << size / simd_ns
+                  << " GB/s, operator+ " << size / concat_ns << " GB/s\n";
     }
+    delete[] src;
+    delete[] dst;
+}
 
-    void push_back(char ch) {
-        if (length_ + 1 > capacity_) {
-            size_t newcap = capacity_ == 0 ? 1 : capacity_ * 2;
-            if (newcap < length_ + 1) newcap = length_ + 1;
-            reserve(newcap); // может бросить
-        }
-        data_[length_++] = ch;
-        data_[length_] = '\0';
+// Ресурс-счётчик: пропускает запросы в upstream и считает выделения.
+// На время набора бенчмарков ставится ресурсом по умолчанию.
+class CountingResource : public MemoryResource {
+public:
+    explicit CountingResource(MemoryResource* upstream) : upstream_(upstream), allocations_(0) {}
+
+    size_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+    void reset() { allocations_.store(0, std::memory_order_relaxed); }
+
+protected:
+    void* do_allocate(size_t bytes) override {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        return upstream_->allocate(bytes);
     }
+    void do_deallocate(void* p, size_t bytes) noexcept override { upstream_->deallocate(p, bytes); }
 
-    // -------------------- Новая функция: символы, не являющиеся общими --------------------
-    // Формирует строку, содержащую все вхождения символов из *this и other,
-    // которые НЕ встречаются в другой строке.
-    // Учитываются только ASCII 0..127; порядок и количество вхождений сохраняются.
-    String unique_chars_with(const String& other) const {
-        // Массивы присутствия символов (ASCII 0..127)
-        bool in_this[128] = { false };
-        bool in_other[128] = { false };
+private:
+    MemoryResource* upstream_;
+    std::atomic<size_t> allocations_;
+};
 
-        // Заполняем присутствие для this
-        for (size_t i = 0; i < length_; ++i) {
-            unsigned char uc = static_cast<unsigned char>(data_[i]);
-            if (uc < 128) in_this[uc] = true;
-        }
-        // Заполняем присутствие для other
-        for (size_t i = 0; i < other.length_; ++i) {
-            unsigned char uc = static_cast<unsigned char>(other.data_[i]);
-            if (uc < 128) in_other[uc] = true;
+struct Result {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+// Как в Google Benchmark: число итераций растёт, пока замер не займёт
+// не меньше kMinTime, и результат берётся по последнему прогону
+template <class F>
+Result measure(CountingResource& counter, F f) {
+    const double kMinTime = 0.05e9; // нс
+    size_t iters = 1;
+    for (;;) {
+        counter.reset();
+        double ns = time_per_op_ns(iters, f);
+        double total = ns * static_cast<double>(iters);
+        if (total >= kMinTime || iters >= (size_t(1) << 30)) {
+            Result r = { ns, static_cast<double>(counter.allocations()) / static_cast<double>(iters) };
+            return r;
         }
+        double grow = total > 0 ? kMinTime * 1.4 / total : 10.0;
+        if (grow < 2) grow = 2;
+        if (grow > 100) grow = 100;
+        iters = static_cast<size_t>(static_cast<double>(iters) * grow);
+    }
+}
 
-        // Выделяем максимально возможный буфер (length_ + other.length_)
-        size_t maxlen = length_ + other.length_;
-        char* buf = allocate_buffer(maxlen); // может бросить
+// processed — сколько байт операция читает или пишет; 0 — пропускная
+// способность не имеет смысла (move, reserve), вместо МБ/с печатается "-"
+void report(const char* name, size_t size, size_t processed, const Result& r) {
+    std::cout << std::left << std::setw(22) << name << std::right << std::setw(10) << size
+              << std::fixed << std::setprecision(1) << std::setw(14) << r.ns_per_op << std::setw(12);
+    if (processed && r.ns_per_op > 0)
+        std::cout << static_cast<double>(processed) / r.ns_per_op * 1e3; // байт/нс -> МБ/с
+    else
+        std::cout << "-";
+    std::cout << std::setprecision(2) << std::setw(12) << r.allocs_per_op << '\n';
+    std::cout.unsetf(std::ios_base::floatfield);
+}
 
-        size_t pos = 0;
-        // Добавляем символы из this, которые не встречаются в other
-        for (size_t i = 0; i < length_; ++i) {
-            unsigned char uc = static_cast<unsigned char>(data_[i]);
-            if (uc < 128 && !in_other[uc]) {
-                buf[pos++] = data_[i];
-            }
+bool selected(const char* filter, const char* name) {
+    return !filter || StringView(name).starts_with(StringView(filter));
+}
+
+// Строка из n байт с повторяющимся алфавитом
+String make_text(size_t n) {
+    String s;
+    s.reserve(n);
+    for (size_t i = 0; i < n; ++i) s.push_back(static_cast<char>('a' + i % 26));
+    return s;
+}
+
+// Строка из n байт: латиница вперемешку с кириллицей (по 2 байта на букву),
+// без оборванной последовательности в конце
+String make_utf8_text(size_t n) {
+    static const char kPattern[] = "text \xD1\x82\xD0\xB5\xD0\xBA\xD1\x81\xD1\x82 "; // "text текст "
+    const size_t kPatternLength = sizeof(kPattern) - 1;
+    String s;
+    s.reserve(n);
+    while (s.length() + kPatternLength <= n) s.append(kPattern, kPatternLength);
+    while (s.length() < n) s.push_back(' ');
+    return s;
+}
+
+// Набор параметризованных бенчмарков по размерам от 0 Б до 16 МБ.
+// filter — префикс имени бенчмарка (nullptr — все).
+// Колонки: размер в байтах, нс на операцию, МБ/с, выделений на операцию.
+void run_suite(const char* filter) {
+    static const size_t kSizes[] = { 0, 15, 64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+    const size_t kSizeCount = sizeof(kSizes) / sizeof(kSizes[0]);
+
+    CountingResource counter(NewDeleteResource::instance());
+    MemoryResource* previous = MemoryResource::set_default_resource(&counter);
+
+    std::cout << "String benchmarks (kernel: " << simd::kernel_name() << ")\n"
+              << std::left << std::setw(22) << "benchmark" << std::right << std::setw(10) << "bytes"
+              << std::setw(14) << "ns/op" << std::setw(12) << "MB/s" << std::setw(12) << "allocs/op" << '\n';
+
+    for (size_t k = 0; k < kSizeCount; ++k) {
+        const size_t n = kSizes[k];
+        String text = make_text(n);
+        String same = text;
+        String other = text;
+        if (n) other[n - 1] = '#'; // отличие в последнем байте: сравнение проходит всю строку
+        String third = make_text(n / 3);
+
+        if (selected(filter, "construct"))
+            report("construct", n, n, measure(counter, [&] {
+                String s(text.c_str());
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "construct_pooled")) {
+            RecyclingResource recycler(RecyclingResource::Limits::defaults(), &counter);
+            report("construct_pooled", n, n, measure(counter, [&] {
+                String s(text.view(), &recycler);
+                g_sink = s.c_str()[0];
+            }));
         }
-        // Добавляем символы из other, которые не встречаются в this
-        for (size_t i = 0; i < other.length_; ++i) {
-            unsigned char uc = static_cast<unsigned char>(other.data_[i]);
-            if (uc < 128 && !in_this[uc]) {
-                buf[pos++] = other.data_[i];
-            }
+        if (selected(filter, "copy"))
+            report("copy", n, n, measure(counter, [&] {
+                String s = text;
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "move"))
+            report("move", n, 0, measure(counter, [&] {
+                String s = std::move(text);
+                text = std::move(s);
+                g_sink = text.c_str()[0];
+            }));
+        if (selected(filter, "concat3"))
+            report("concat3", third.length() * 3, third.length() * 3, measure(counter, [&] {
+                String s = third + third + third;
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "append64"))
+            report("append64", n, n, measure(counter, [&] {
+                String s;
+                for (size_t done = 0; done < n; done += 64)
+                    s += StringView(text.c_str() + done, n - done < 64 ? n - done : 64);
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "push_back"))
+            report("push_back", n, n, measure(counter, [&] {
+                String s;
+                for (size_t i = 0; i < n; ++i) s.push_back('x');
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "append_fill"))
+            report("append_fill", n, n, measure(counter, [&] {
+                String s;
+                s.append(n, 'x'); // то же, что цикл push_back выше, одним блоком
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "reserve"))
+            report("reserve", n, 0, measure(counter, [&] {
+                String s;
+                s.reserve(n);
+                g_sink = s.c_str()[0];
+            }));
+        if (selected(filter, "equal"))
+            report("equal", n, n * 2, measure(counter, [&] { g_sink = (text == same); }));
+        if (selected(filter, "compare"))
+            report("compare", n, n * 2, measure(counter, [&] { g_sink = static_cast<char>(text.compare(other)); }));
+        if (selected(filter, "to_lower"))
+            report("to_lower", n, n, measure(counter, [&] {
+                String u = text.lower_copy();
+                g_sink = u.c_str()[0];
+            }));
+        if (selected(filter, "compare_icase"))
+            report("compare_icase", n, n * 2, measure(counter, [&] { g_sink = static_cast<char>(text.compare_icase(other)); }));
+        if (selected(filter, "count_if"))
+            report("count_if", n, n, measure(counter, [&] { g_sink = static_cast<char>(text.count_if(CharClass::Alnum)); }));
+        if (selected(filter, "utf8_valid")) {
+            String mixed = make_utf8_text(n);
+            report("utf8_valid", n, n, measure(counter, [&] { g_sink = mixed.is_valid_utf8(); }));
         }
-        buf[pos] = '\0';
+        if (selected(filter, "unique_code_points")) {
+            String mixed = make_utf8_text(n);
+            String mixed_other = make_utf8_text(n / 2);
+            report("unique_code_points", n + n / 2, n + n / 2, measure(counter, [&] {
+                String u = mixed.unique_code_points_with(mixed_other);
+                g_sink = u.c_str()[0];
+            }));
+        }
+        if (selected(filter, "unique_chars"))
+            report("unique_chars", n, n * 2, measure(counter, [&] {
+                String u = text.unique_chars_with(other);
+                g_sink = u.c_str()[0];
+            }));
+    }
 
-        // Формируем результат
-        String result;
-        delete[] result.data_;
-        result.data_ = buf;
-        result.length_ = pos;
-        result.capacity_ = pos;
-        return result;
+    // Числа: одна операция — запись или разбор kNumbers значений через ','
+    const size_t kNumbers = 1000;
+    std::vector<long long> ints(kNumbers);
+    std::vector<double> doubles(kNumbers);
+    uint64_t state = 88172645463325252ull; // xorshift64
+    for (size_t i = 0; i < kNumbers; ++i) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        ints[i] = static_cast<long long>(state >> (state % 64));
+        doubles[i] = static_cast<double>(state % 10000000) / 1000.0;
     }
-};
+    String int_text, double_text;
+    for (size_t i = 0; i < kNumbers; ++i) {
+        int_text.append_int(ints[i]).push_back(',');
+        double_text.append_double(doubles[i]).push_back(',');
+    }
+    if (selected(filter, "append_int"))
+        report("append_int", int_text.length(), int_text.length(), measure(counter, [&] {
+            String s;
+            for (size_t i = 0; i < kNumbers; ++i) s.append_int(ints[i]).push_back(',');
+            g_sink = s.c_str()[0];
+        }));
+    if (selected(filter, "append_double"))
+        report("append_double", double_text.length(), double_text.length(), measure(counter, [&] {
+            String s;
+            for (size_t i = 0; i < kNumbers; ++i) s.append_double(doubles[i]).push_back(',');
+            g_sink = s.c_str()[0];
+        }));
+    if (selected(filter, "parse_int"))
+        report("parse_int", int_text.length(), int_text.length(), measure(counter, [&] {
+            long long sum = 0, v = 0;
+            for (StringView field : int_text.split(',')) sum += field.parse_int(v) ? v : 0;
+            g_sink = static_cast<char>(sum);
+        }));
+    if (selected(filter, "parse_double"))
+        report("parse_double", double_text.length(), double_text.length(), measure(counter, [&] {
+            double sum = 0, v = 0;
+            for (StringView field : double_text.split(',')) sum += field.parse_double(v) ? v : 0;
+            g_sink = static_cast<char>(sum);
+        }));
+
+    MemoryResource::set_default_resource(previous);
+    if (selected(filter, "kernels")) run_copy();
+}
+
+} // namespace bench
 
 // -------------------- Тестирование в main -------------------
-int main() {
+int main(int argc, char* argv[]) {
     setlocale(LC_ALL, "ru");
+#if defined(IND3_BENCH_MAIN)
+    bench::run_suite(argc > 1 ? argv[1] : nullptr); // ind3_bench.exe [префикс имени]
+    return 0;
+#endif
+    if (argc > 1 && String(argv[1]) == String("--bench")) {
+        bench::run_suite(argc > 2 ? argv[2] : nullptr); // ind3.exe --bench [префикс имени]
+        return 0;
+    }
     try {
 
         ////////////////////////////////////////////////////////////////////////////////////
@@ -371,8 +5694,159 @@ int main() {
         std::cout << "Пример 2: a2=\"" << a2.c_str() << "\", b2=\"" << b2.c_str() << "\" -> unique: \"" << uniq2.c_str() << "\"\n";
         // Ожидаемый результат: "aaay" (все 'a' из a2, т.к. 'a' не в b2; и 'y' из b2, т.к. 'y' не в a2)
 
+        // Потоковый unique_chars_with: два прохода по кускам, память не растёт с входом
+        UniqueCharsStream stream;
+        const char* parts1[] = { "abra", "cad", "abra" };
+        const char* parts2[] = { "bar", "bar" };
+        for (const char* p : parts1) stream.scan_first(p);
+        for (const char* p : parts2) stream.scan_second(p);
+        String streamed;
+        for (const char* p : parts1) stream.filter_first(p, [&streamed](StringView out) { streamed += out; });
+        for (const char* p : parts2) stream.filter_second(p, [&streamed](StringView out) { streamed += out; });
+        std::cout << "streamed unique: " << streamed.c_str() << ", length " << stream.result_length() << '\n';
+
+        // Вычислено при компиляции: ни одного выделения до перевода в String
+        constexpr FixedString<32> config_key = make_fixed("db.") + "connection" + ".timeout";
+        constexpr FixedString<16> reference = make_fixed("aaabx").unique_chars_with(make_fixed("bbbxy"));
+        std::cout << "constexpr key: " << config_key.c_str() << ", constexpr unique: "
+                  << reference.to_string().c_str() << '\n';
+
+        // Строки в арене: вся память освобождается разом при выходе из блока
+        {
+            ArenaResource arena;
+            String k1("request-key-with-a-long-prefix", &arena);
+            String k2 = k1 + k1; // результат берёт память из той же арены
+            std::cout << "arena: " << k2.c_str() << ", len=" << k2.length() << '\n';
+        }
+
+        // Разбор полей через StringView — без копирования
+        String frame("GET /index.html HTTP/1.1");
+        for (StringView field : frame.split(' ')) {
+            std::cout << "field: \"" << String(field).c_str() << "\"\n";
+        }
+        std::cout << "frame.find(\"index\") = " << frame.find("index") << '\n';
+
+        // Копирование при записи: копия делит буфер, пока её не изменят
+        String payload("large read-mostly payload shared by value");
+        payload.make_shareable();
+        String copy1 = payload;
+        std::cout << "COW use_count after copy: " << payload.use_count() << '\n';
+        copy1.push_back('!');
+        std::cout << "COW use_count after write: " << payload.use_count() << ", copy: " << copy1.c_str() << '\n';
+        char& first = payload[0]; // ссылка выдана: копии не делят буфер
+        String copy2 = payload;
+        first = 'L';
+        std::cout << "COW after leaked reference: use_count " << payload.use_count()
+                  << ", copy2[0]=" << copy2[0] << ", payload[0]=" << payload[0] << '\n';
+
+        // Интернирование: равные значения получают один и тот же дескриптор
+        StringPool tags;
+        InternedString t1 = tags.intern("content-type");
+        String header_name = String("content-") + "type";
+        InternedString t2 = tags.intern(header_name);
+        std::cout << "interned equal: " << (t1 == t2) << ", same storage: "
+                  << (t1.c_str() == t2.c_str()) << ", pool size: " << tags.size() << '\n';
+
+        // Сборка строки из нескольких потоков без общей блокировки
+        StringBuilder log_builder;
+        std::thread writer([&log_builder] { log_builder += "worker line\n"; });
+        writer.join();
+        log_builder += "main line\n";
+        String log = log_builder.finish();
+        std::cout << "builder: " << log.length() << " bytes, capacity " << log.capacity() << '\n';
+
+        // Параллельная сортировка и удаление повторов
+        parallel::ThreadPool workers(2);
+        std::vector<String> keys;
+        keys.push_back(String("delta"));
+        keys.push_back(String("alpha"));
+        keys.push_back(String("charlie"));
+        keys.push_back(String("alpha"));
+        parallel::dedupe(keys, workers);
+        std::cout << "dedupe:";
+        for (size_t i = 0; i < keys.size(); ++i) std::cout << ' ' << keys[i].c_str();
+        std::cout << '\n';
+
+        // Словарь в одном буфере: элементы — взгляды на общий блок байтов
+        StringTable dict;
+        dict.push_back("pear");
+        dict.push_back("apple");
+        dict.push_back("fig");
+        dict.sort();
+        std::cout << "table:";
+        for (StringView word : dict) std::cout << ' ' << String(word).c_str();
+        std::cout << ", lower_bound(\"b\") = " << dict.lower_bound("b") << '\n';
+
+        // Файл без копирования: корпус отображается в память и режется на строки
+        if (argc > 0 && argv[0]) {
+            MappedFile self = String::map_file(argv[0]);
+            std::cout << "map_file(argv[0]): loaded " << (self.size() > 0) << ", mapped " << self.is_mapped() << '\n';
+        }
+
+        // Сериализация прямо в буфер: без проверки ёмкости на каждый байт
+        String record;
+        record.append("id=", 3).append(4, '0');
+        record.resize_and_overwrite(record.length() + 8, [&record](char* buf, size_t n) {
+            size_t len = record.length();
+            const char digits[] = "42;";
+            for (size_t i = 0; digits[i] && len < n; ++i) buf[len++] = digits[i];
+            return len;
+        });
+        std::cout << "serialized: " << record.c_str() << '\n';
+
+        // Ответ из кусков: отправляется через writev/WSASend без склейки
+        StringChain response;
+        String body("{\"status\":\"ok\",\"items\":[1,2,3]}");
+        response.append_copy("HTTP/1.1 200 OK\r\n\r\n").append(std::move(body));
+        IoBuffer iov[4];
+        std::cout << "chain: " << response.piece_count() << " pieces, " << response.io_buffers(iov, 4)
+                  << " io buffers, " << response.length() << " bytes, flattened: "
+                  << response.flatten().length() << " bytes\n";
+        StringChain queued(std::move(response)); // куски остаются на месте
+        std::cout << "moved chain: " << String(queued.piece(1)).c_str() << ", source empty: "
+                  << response.empty() << '\n';
+
+        // Нормализация регистра и классы символов перед сравнением
+        String header("Content-Type: TEXT/html; charset=UTF-8");
+        std::cout << "lower: " << header.lower_copy().c_str() << ", icase == "
+                  << header.equals_icase("content-type: text/HTML; charset=utf-8")
+                  << ", alpha " << header.count_if(CharClass::Alpha)
+                  << ", digits " << header.count_if(CharClass::Digit)
+                  << ", spaces " << header.count_if(CharClass::Space) << '\n';
+
+        // Буферы уничтоженных строк переиспользуются без обращения к new
+        RecyclingResource recycler;
+        for (int i = 0; i < 1000; ++i) {
+            String request(StringView("GET /api/v1/items?page=2&limit=50 HTTP/1.1"), &recycler);
+            request += "\r\nHost: example.org\r\n";
+        }
+        std::cout << "recycling: 1000 requests, " << recycler.upstream_allocations() << " upstream allocations\n";
+
+        // Кириллица: уникальные символы по кодовым точкам, а не по байтам
+        String greeting("привет мир"), farewell("пока мир");
+        std::cout << "utf-8: valid " << greeting.is_valid_utf8() << ", " << greeting.length() << " bytes, "
+                  << greeting.code_point_count() << " code points, unique: "
+                  << greeting.unique_code_points_with(farewell).c_str() << '\n';
+
+        // Метрики: числа пишутся и читаются прямо в буфере строки
+        String metric("latency_ms=");
+        metric.append_int(-42).push_back(',');
+        metric.append_double(0.1 + 0.2);
+        double latency = 0;
+        size_t used = metric.substr(metric.find(',') + 1).parse_double(latency);
+        std::cout << "metric: " << metric.c_str() << ", parsed " << used << " chars -> "
+                  << (latency == 0.1 + 0.2) << '\n';
+
+        // Посимвольный обход без проверок границ
+        size_t a_count = 0;
+        for (char ch : s5) a_count += (ch == 'a');
+        std::cout << "'a' in s5: " << a_count << '\n';
+
+        // Счётчики выделений и операций (сборка с IND3_STATS)
+        if (stats::kEnabled) stats::print(std::cout, stats::snapshot());
+
         // Демонстрация проверки границ: намеренно вызвать исключение
-        char ch = x[100]; // бросит std::out_of_range
+        char ch = x.at(100); // бросит std::out_of_range в любой сборке
 
         return 0;
     }